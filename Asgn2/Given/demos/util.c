@@ -31,6 +31,7 @@
 #include "../../lwp.h"
 #include "util.h"
 
+int SIGTSTPcounter = 0;         /* bumped by SIGTSTP_handler */
 
 #ifdef OLDSCHEDULERS
 /********************************************************
@@ -41,7 +42,6 @@ int OLD_AlwaysZero() {
   return 0;
 }
 
-int SIGTSTPcounter = 0;
 int OLD_ChangeOnSIGTSTP() {
   /* Move to the next one, counting TSTPs*/
   return SIGTSTPcounter%lwp_procs;
@@ -102,6 +102,90 @@ int OLD_ChooseHighestColor(){
 }
 
 
+#else
+/********************************************************
+ * The same policies on top of the priority scheduler
+ * (prio_scheduler.c), so picking the next one is O(1).
+ ********************************************************/
+static thread picked = NULL;    /* last thread handed out by next() */
+static int seen = 0;            /* SIGTSTPcounter when last advanced */
+
+static thread sticky_next(void) {
+  /* remember who we chose, lwp_yield() will hand it back to admit */
+  return picked = prio_next();
+}
+
+static void zero_admit(thread t) {
+  /* always run the first one: it goes back to the front */
+  if ( t == picked )
+    prio_push(t);
+  else
+    prio_admit(t);
+}
+
+static void tstp_admit(thread t) {
+  /* stay on the current one until a TSTP has come in, then move
+   * on one thread per TSTP, so it is still SIGTSTPcounter%procs
+   * (counting from the first one) that runs.
+   */
+  int skip;
+  thread u;
+
+  if ( t != picked ) {
+    prio_admit(t);
+  } else if ( seen == SIGTSTPcounter ) {
+    prio_push(t);
+  } else {
+    skip = SIGTSTPcounter - seen - 1;
+    seen = SIGTSTPcounter;
+    prio_admit(t);
+    for(skip %= prio_qlen(); skip > 0; skip--) {
+      u = prio_next();
+      prio_remove(u);
+      prio_admit(u);
+    }
+  }
+}
+
+static void lowest_admit(thread t) {
+  /* one level per color, lowest first.  Threads that are not
+   * snakes go after all of them. Round-robin within colors.
+   */
+  snake s = snakeFromLWpid(t->tid);
+  t->priority = s ? s->color : LWP_PRIO_LEVELS-1;
+  prio_admit(t);
+}
+
+static void highest_admit(thread t) {
+  /* the same, highest color first */
+  snake s = snakeFromLWpid(t->tid);
+  t->priority = s ? MAX_VISIBLE_SNAKE+1-s->color : LWP_PRIO_LEVELS-1;
+  prio_admit(t);
+}
+
+static struct scheduler zero_tuple = {
+  prio_init, prio_shutdown, zero_admit, prio_remove, sticky_next, prio_qlen,
+  NULL, NULL
+};
+static struct scheduler tstp_tuple = {
+  prio_init, prio_shutdown, tstp_admit, prio_remove, sticky_next, prio_qlen,
+  NULL, NULL
+};
+static struct scheduler lowest_tuple = {
+  prio_init, prio_shutdown, lowest_admit, prio_remove, prio_next, prio_qlen,
+  NULL, NULL
+};
+static struct scheduler highest_tuple = {
+  prio_init, prio_shutdown, highest_admit, prio_remove, prio_next, prio_qlen,
+  NULL, NULL
+};
+
+scheduler AlwaysZero         = &zero_tuple;
+scheduler ChangeOnSIGTSTP    = &tstp_tuple;
+scheduler ChooseLowestColor  = &lowest_tuple;
+scheduler ChooseHighestColor = &highest_tuple;
+#endif
+
 /********************************************************
  * End scheduling algorithms
  * Now the signal handling material
@@ -110,7 +194,6 @@ int OLD_ChooseHighestColor(){
 void SIGTSTP_handler(int num){
   SIGTSTPcounter++;              /* increment the counter */
 }
-#endif
 
 void SIGINT_handler(int num){
   kill_snake();                 /* mark a snake for death */
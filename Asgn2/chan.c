@@ -0,0 +1,528 @@
+/*
+ * Description: This file contains channels: FIFO queues of fixed-size
+ *              elements between LWPs, either unbuffered, bounded or
+ *              unbounded. A thread that has to wait is parked on the
+ *              channel's list of senders or receivers. A sender that
+ *              finds a receiver waiting copies the element straight into
+ *              the receiver's buffer and switches to it, so a message
+ *              costs one switch and never touches the channel's buffer.
+ *              lwp_chan_select() waits on several channels at once, so
+ *              a waiter is a node of its own rather than the thread's
+ *              sched links.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHAN_MIN 16                 /* first buffer of an unbounded one */
+#define CHAN_LOCAL 4                /* cases a wait can keep on its stack */
+
+/* one blocked send, receive or select */
+typedef struct chan_op {
+    thread        t;
+    int           done;             /* one of its cases has completed */
+    int           fired;            /* which one                      */
+    int           result;           /* 0 or LWP_CHAN_CLOSED           */
+} chan_op;
+
+/* its place on one channel's list (circular, the head's prev is the
+   tail; next is NULL when it is on none) */
+typedef struct chan_node {
+    struct chan_node *next;
+    struct chan_node *prev;
+    chan_op       *op;
+    void          *data;            /* element to send or receive into */
+    int           index;            /* case number                     */
+} chan_node;
+
+static unsigned int rotor = 0;      /* where select starts looking */
+
+/*
+ * Description:
+ *   Adds a node to the back of a channel's wait list.
+ * Parameters:
+ *   The list head and the node.
+ * Returns:
+ *   Nothing.
+ */
+static void node_append(chan_node **head, chan_node *n) {
+    if (*head == NULL) {
+        n->next = n->prev = n;
+        *head = n;
+    } else {
+        n->next = *head;
+        n->prev = (*head)->prev;
+        (*head)->prev->next = n;
+        (*head)->prev = n;
+    }
+}
+
+/*
+ * Description:
+ *   Takes a node off a channel's wait list. Does nothing if it is on
+ *   none.
+ * Parameters:
+ *   The list head and the node.
+ * Returns:
+ *   Nothing.
+ */
+static void node_remove(chan_node **head, chan_node *n) {
+    if (n->next == NULL) {
+        return;
+    }
+    if (n->next == n) {
+        *head = NULL;
+    } else {
+        n->prev->next = n->next;
+        n->next->prev = n->prev;
+        if (*head == n) {
+            *head = n->next;
+        }
+    }
+    n->next = n->prev = NULL;
+}
+
+/*
+ * Description:
+ *   Takes the first waiter off a list whose operation is still open.
+ *   Nodes of a select that another case already completed are dropped
+ *   on the way.
+ * Parameters:
+ *   The list head.
+ * Returns:
+ *   The node, or NULL if nobody is waiting.
+ */
+static chan_node *node_pop(chan_node **head) {
+    while (*head != NULL) {
+        chan_node *n = *head;
+        node_remove(head, n);
+        if (n->op->done == FALSE) {
+            return n;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Description:
+ *   Completes a waiter's operation and makes it runnable.
+ * Parameters:
+ *   The node that completed and the result to give it.
+ * Returns:
+ *   The waiter's thread.
+ */
+static thread fire(chan_node *n, int result) {
+    n->op->done = TRUE;
+    n->op->fired = n->index;
+    n->op->result = result;
+    thread_unpark(n->op->t);
+    return n->op->t;
+}
+
+/*
+ * Description:
+ *   Finds a buffer slot.
+ * Parameters:
+ *   The channel and the slot number (from the oldest element).
+ * Returns:
+ *   Its address.
+ */
+static char *slot(lwp_chan *ch, size_t i) {
+    return ch->buf + ((ch->first + i) % ch->slots) * ch->elemsize;
+}
+
+/*
+ * Description:
+ *   Doubles an unbounded channel's buffer, putting the oldest element
+ *   first.
+ * Parameters:
+ *   The channel.
+ * Returns:
+ *   0 on success, -1 if the buffer cannot grow.
+ */
+static int grow(lwp_chan *ch) {
+    size_t slots = (ch->slots == 0) ? CHAN_MIN : ch->slots * 2;
+    char *buf = malloc(slots * ch->elemsize);
+    size_t i;
+    if (buf == NULL) {
+        perror("error growing channel");
+        return -1;
+    }
+    for (i = 0; i < ch->len; i++) {
+        memcpy(buf + i * ch->elemsize, slot(ch, i), ch->elemsize);
+    }
+    free(ch->buf);
+    ch->buf = buf;
+    ch->slots = slots;
+    ch->first = 0;
+    return 0;
+}
+
+/*
+ * Description:
+ *   Sends without waiting: to a waiting receiver if there is one, else
+ *   into the buffer if it has room.
+ * Parameters:
+ *   The channel, the element, and where to put the receiver woken (or
+ *   NULL).
+ * Returns:
+ *   0 if sent, -1 if it would have to wait, LWP_CHAN_CLOSED if the
+ *   channel is closed.
+ */
+static int put(lwp_chan *ch, const void *elem, thread *woke) {
+    if (ch->closed) {
+        return LWP_CHAN_CLOSED;
+    }
+    chan_node *n = node_pop(&ch->recvq);
+    if (n != NULL) {
+        memcpy(n->data, elem, ch->elemsize);
+        thread t = fire(n, 0);
+        if (woke != NULL) {
+            *woke = t;
+        }
+        return 0;
+    }
+    /* straight into the receiver's hands */
+
+    if (ch->len == ch->slots) {
+        if (ch->cap != LWP_CHAN_UNBOUNDED || grow(ch) == -1) {
+            return -1;
+        }
+    }
+    memcpy(slot(ch, ch->len), elem, ch->elemsize);
+    ch->len++;
+    return 0;
+}
+
+/*
+ * Description:
+ *   Receives without waiting: from the buffer if it has anything
+ *   (refilling it from the first waiting sender), else straight from a
+ *   waiting sender.
+ * Parameters:
+ *   The channel and where to put the element.
+ * Returns:
+ *   0 if received, -1 if it would have to wait, LWP_CHAN_CLOSED if
+ *   the channel is closed and empty.
+ */
+static int take(lwp_chan *ch, void *elem) {
+    chan_node *n;
+    if (ch->len > 0) {
+        memcpy(elem, slot(ch, 0), ch->elemsize);
+        ch->first = (ch->first + 1) % ch->slots;
+        ch->len--;
+        n = node_pop(&ch->sendq);
+        if (n != NULL) {
+            memcpy(slot(ch, ch->len), n->data, ch->elemsize);
+            ch->len++;
+            fire(n, 0);
+        }
+        return 0;
+    }
+    n = node_pop(&ch->sendq);
+    if (n != NULL) {
+        memcpy(elem, n->data, ch->elemsize);
+        fire(n, 0);
+        return 0;
+    }
+    return ch->closed ? LWP_CHAN_CLOSED : -1;
+}
+
+/*
+ * Description:
+ *   Parks the caller on one channel list per case until one of them
+ *   completes. The nodes live on the caller's stack, except for big
+ *   selects and for threads on a shared stack: that stack cannot be
+ *   written while its thread is switched out, so their nodes and
+ *   elements (through bounce buffers) go on the heap. Must be called
+ *   inside preempt_enter().
+ * Parameters:
+ *   The cases and how many there are.
+ * Returns:
+ *   The case that completed (its result filled in), or -1 if no other
+ *   thread could ever run to complete one.
+ */
+static int block(lwp_chancase *cases, int n) {
+    int shared = (running->flags & LWP_SHARED) != 0;
+    size_t size = sizeof(chan_op) + n * sizeof(chan_node);
+    int i;
+    if (shared) {
+        for (i = 0; i < n; i++) {
+            size += cases[i].chan->elemsize;
+        }
+    }
+    struct {
+        chan_op   op;
+        chan_node nodes[CHAN_LOCAL];
+    } local;
+    char *mem = (char *)&local;
+    if (shared || n > CHAN_LOCAL) {
+        mem = malloc(size);
+        if (mem == NULL) {
+            perror("error allocating channel wait");
+            return -1;
+        }
+    }
+    chan_op *op = (chan_op *)mem;
+    chan_node *nodes = (chan_node *)(mem + sizeof(chan_op));
+    char *bounce = (char *)(nodes + n);
+
+    op->t = running;
+    op->done = FALSE;
+    op->fired = -1;
+    op->result = 0;
+    thread_park(running);
+    if (!wake_possible()) {
+        thread_unpark(running);
+        if (mem != (char *)&local) {
+            free(mem);
+        }
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        lwp_chan *ch = cases[i].chan;
+        nodes[i].op = op;
+        nodes[i].index = i;
+        nodes[i].data = cases[i].data;
+        if (shared) {
+            nodes[i].data = bounce;
+            bounce += ch->elemsize;
+            if (cases[i].send) {
+                memcpy(nodes[i].data, cases[i].data, ch->elemsize);
+            }
+        }
+        node_append(cases[i].send ? &ch->sendq : &ch->recvq, &nodes[i]);
+    }
+    lwp_yield();
+
+    for (i = 0; i < n; i++) {
+        lwp_chan *ch = cases[i].chan;
+        node_remove(cases[i].send ? &ch->sendq : &ch->recvq, &nodes[i]);
+    }
+    /* the one that fired is already off its list */
+    i = op->fired;
+    cases[i].result = op->result;
+    if (shared && !cases[i].send && op->result == 0) {
+        memcpy(cases[i].data, nodes[i].data, cases[i].chan->elemsize);
+    }
+    if (mem != (char *)&local) {
+        free(mem);
+    }
+    return i;
+}
+
+/*
+ * Description:
+ *   Creates a channel.
+ * Parameters:
+ *   The size of an element, and how many can be buffered: 0 for an
+ *   unbuffered channel (every send waits for a receiver) or
+ *   LWP_CHAN_UNBOUNDED for one whose sends never wait.
+ * Returns:
+ *   The channel, or NULL on error.
+ */
+lwp_chan *lwp_chan_new(size_t elemsize, size_t cap) {
+    if (elemsize == 0) {
+        perror("channel elements cannot be empty");
+        return NULL;
+    }
+    int was = preempt_enter();
+    lwp_chan *ch = malloc(sizeof(lwp_chan));
+    if (ch == NULL) {
+        perror("error allocating channel");
+        preempt_leave(was);
+        return NULL;
+    }
+    ch->elemsize = elemsize;
+    ch->cap = cap;
+    ch->len = 0;
+    ch->first = 0;
+    ch->slots = 0;
+    ch->buf = NULL;
+    ch->closed = FALSE;
+    ch->sendq = NULL;
+    ch->recvq = NULL;
+    if (cap != 0 && cap != LWP_CHAN_UNBOUNDED) {
+        ch->buf = malloc(cap * elemsize);
+        if (ch->buf == NULL) {
+            perror("error allocating channel");
+            free(ch);
+            ch = NULL;
+        } else {
+            ch->slots = cap;
+        }
+    }
+    preempt_leave(was);
+    return ch;
+}
+
+/*
+ * Description:
+ *   Frees a channel and anything still buffered in it.
+ * Parameters:
+ *   The channel.
+ * Returns:
+ *   0 on success, -1 if threads are still waiting on it.
+ */
+int lwp_chan_free(lwp_chan *ch) {
+    int was = preempt_enter();
+    if (ch->sendq != NULL || ch->recvq != NULL) {
+        preempt_leave(was);
+        return -1;
+    }
+    free(ch->buf);
+    free(ch);
+    preempt_leave(was);
+    return 0;
+}
+
+/*
+ * Description:
+ *   Sends an element, waiting while the channel is full (or, if it is
+ *   unbuffered, until a receiver takes it). A receiver that was waiting
+ *   is switched to at once.
+ * Parameters:
+ *   The channel and the element to copy in.
+ * Returns:
+ *   0 once sent, LWP_CHAN_CLOSED if the channel is or gets closed, or
+ *   -1 if no receiver could ever come.
+ */
+int lwp_chan_send(lwp_chan *ch, const void *elem) {
+    int was = preempt_enter();
+    thread woke = NULL;
+    int ret = put(ch, elem, &woke);
+    if (ret == -1) {
+        lwp_chancase c = { ch, TRUE, (void *)elem, 0 };
+        ret = (block(&c, 1) == -1) ? -1 : c.result;
+    } else if (woke != NULL) {
+        lwp_yield_to(woke->tid);
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Receives an element, waiting while the channel is empty.
+ * Parameters:
+ *   The channel and where to copy the element to.
+ * Returns:
+ *   0 once received, LWP_CHAN_CLOSED if the channel is closed and
+ *   empty, or -1 if no sender could ever come.
+ */
+int lwp_chan_recv(lwp_chan *ch, void *elem) {
+    int was = preempt_enter();
+    int ret = take(ch, elem);
+    if (ret == -1) {
+        lwp_chancase c = { ch, FALSE, elem, 0 };
+        ret = (block(&c, 1) == -1) ? -1 : c.result;
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Sends an element only if that needs no waiting.
+ * Parameters:
+ *   The channel and the element.
+ * Returns:
+ *   0 if sent, -1 if it would wait, LWP_CHAN_CLOSED if closed.
+ */
+int lwp_chan_try_send(lwp_chan *ch, const void *elem) {
+    int was = preempt_enter();
+    thread woke = NULL;
+    int ret = put(ch, elem, &woke);
+    if (woke != NULL) {
+        lwp_yield_to(woke->tid);
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Receives an element only if that needs no waiting.
+ * Parameters:
+ *   The channel and where to copy the element to.
+ * Returns:
+ *   0 if received, -1 if it would wait, LWP_CHAN_CLOSED if closed and
+ *   empty.
+ */
+int lwp_chan_try_recv(lwp_chan *ch, void *elem) {
+    int was = preempt_enter();
+    int ret = take(ch, elem);
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Closes a channel. Waiting senders and receivers are woken with
+ *   LWP_CHAN_CLOSED; what is already buffered can still be received.
+ * Parameters:
+ *   The channel.
+ * Returns:
+ *   0 on success, -1 if it was already closed.
+ */
+int lwp_chan_close(lwp_chan *ch) {
+    int was = preempt_enter();
+    chan_node *n;
+    if (ch->closed) {
+        preempt_leave(was);
+        return -1;
+    }
+    ch->closed = TRUE;
+    while ((n = node_pop(&ch->recvq)) != NULL) {
+        fire(n, LWP_CHAN_CLOSED);
+    }
+    while ((n = node_pop(&ch->sendq)) != NULL) {
+        fire(n, LWP_CHAN_CLOSED);
+    }
+    preempt_leave(was);
+    return 0;
+}
+
+/*
+ * Description:
+ *   Performs whichever of several sends and receives can go first. The
+ *   cases are tried from a rotating starting point so that none is
+ *   starved; if none is ready the caller waits on all of them.
+ * Parameters:
+ *   The cases, how many there are, and whether to wait (FALSE makes it
+ *   a poll).
+ * Returns:
+ *   The index of the case that completed, whose result is then 0 or
+ *   LWP_CHAN_CLOSED, or -1 if none was ready and it could not (or was
+ *   not to) wait.
+ */
+int lwp_chan_select(lwp_chancase *cases, int n, int wait) {
+    if (n < 1) {
+        return -1;
+    }
+    int was = preempt_enter();
+    int start = rotor++ % n;
+    int i, k, ret = -1;
+    thread woke = NULL;
+    for (k = 0; k < n && ret == -1; k++) {
+        i = (start + k) % n;
+        int r = cases[i].send ? put(cases[i].chan, cases[i].data, &woke)
+                              : take(cases[i].chan, cases[i].data);
+        if (r != -1) {
+            cases[i].result = r;
+            ret = i;
+        }
+    }
+    if (ret == -1 && wait) {
+        ret = block(cases, n);
+    } else if (woke != NULL) {
+        lwp_yield_to(woke->tid);
+    }
+    preempt_leave(was);
+    return ret;
+}
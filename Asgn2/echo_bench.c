@@ -0,0 +1,256 @@
+/*
+ * Description: Loopback echo benchmark for the LWP I/O wrappers. An
+ *              acceptor LWP starts one echo LWP per connection; one
+ *              client LWP per connection, in the same process, sends a
+ *              message and waits for it back, over and over. Reports
+ *              round trips per second and round-trip latency.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#define shutdown sock_shutdown  /* lwp.h has a shutdown() of its own */
+#include <sys/socket.h>
+#undef shutdown
+#include "lwp.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ECHO_STACK 65536
+#define MAX_MSG 65536
+
+static int conns = 100;
+static int rounds = 1000;
+static size_t msgsize = 64;
+static struct sockaddr_in addr;
+static long *rtt;                 /* ns of each round trip */
+static long failures = 0;
+
+/*
+ * Description:
+ *   Reads exactly count bytes.
+ * Parameters:
+ *   The descriptor, the buffer and the count.
+ * Returns:
+ *   0, or -1 on error or end of file.
+ */
+static int read_full(int fd, char *buf, size_t count) {
+    size_t got = 0;
+    while (got < count) {
+        ssize_t n = lwp_read(fd, buf + got, count - got);
+        if (n <= 0) {
+            return -1;
+        }
+        got += n;
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ *   LWP body serving one connection: echoes whatever it reads until
+ *   the client hangs up.
+ * Parameters:
+ *   The connected descriptor, cast to a pointer.
+ * Returns:
+ *   0.
+ */
+static int echo_conn(void *arg) {
+    int fd = (int)(long)arg, one = 1;
+    char buf[4096];
+    ssize_t n;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    /* else Nagle holds a short last piece for a delayed ACK */
+    while ((n = lwp_read(fd, buf, sizeof(buf))) > 0) {
+        if (lwp_write(fd, buf, n) != n) {
+            break;
+        }
+    }
+    lwp_close(fd);
+    return 0;
+}
+
+/*
+ * Description:
+ *   LWP body that accepts conns connections, starting a detached
+ *   echo_conn for each.
+ * Parameters:
+ *   The listening descriptor, cast to a pointer.
+ * Returns:
+ *   0, or 1 if accepting failed.
+ */
+static int acceptor(void *arg) {
+    int lfd = (int)(long)arg;
+    lwp_attr attr = { ECHO_STACK, NULL, 0, LWP_DETACHED };
+    int i;
+    for (i = 0; i < conns; i++) {
+        int fd = lwp_accept(lfd, NULL, NULL);
+        if (fd == -1) {
+            perror("echo_bench: accept");
+            return 1;
+        }
+        if (lwp_create_ex(echo_conn, (void *)(long)fd, &attr)
+            == NO_THREAD) {
+            fprintf(stderr, "echo_bench: lwp_create failed\n");
+            lwp_close(fd);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ *   LWP body for one client: connects, then times rounds round trips.
+ * Parameters:
+ *   Its index, cast to a pointer, which picks its slice of rtt.
+ * Returns:
+ *   0, or 1 on failure.
+ */
+static int client(void *arg) {
+    long me = (long)arg;
+    long *out = rtt + me * rounds;
+    char *msg = malloc(msgsize), *buf = malloc(msgsize);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1, i, ret = 1;
+
+    if (msg == NULL || buf == NULL || fd == -1) {
+        goto out;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (lwp_connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("echo_bench: connect");
+        goto out;
+    }
+    memset(msg, 'a' + me % 26, msgsize);
+    for (i = 0; i < rounds; i++) {
+        long start = lwp_now_ns();
+        if (lwp_write(fd, msg, msgsize) != (ssize_t)msgsize
+            || read_full(fd, buf, msgsize) == -1
+            || memcmp(msg, buf, msgsize) != 0) {
+            fprintf(stderr, "echo_bench: round trip failed\n");
+            goto out;
+        }
+        out[i] = lwp_now_ns() - start;
+    }
+    ret = 0;
+out:
+    if (ret != 0) {
+        failures++;
+    }
+    if (fd != -1) {
+        lwp_close(fd);
+    }
+    free(msg);
+    free(buf);
+    return ret;
+}
+
+/*
+ * Description:
+ *   qsort comparison for longs.
+ * Parameters:
+ *   Pointers to the two.
+ * Returns:
+ *   <0, 0 or >0.
+ */
+static int cmp_long(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Description:
+ *   Runs the benchmark and prints the result.
+ * Parameters:
+ *   -c connections (default 100), -r round trips on each (default
+ *   1000), -s message bytes (default 64), -p a preemption quantum in
+ *   us (default none).
+ * Returns:
+ *   0 on success, 1 on error.
+ */
+int main(int argc, char *argv[]) {
+    int opt, lfd, one = 1;
+    long i, quantum = 0;
+    socklen_t len = sizeof(addr);
+
+    while ((opt = getopt(argc, argv, "c:r:s:p:")) != -1) {
+        switch (opt) {
+        case 'c':
+            conns = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 's':
+            msgsize = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            quantum = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c conns] [-r rounds] "
+                    "[-s msgsize] [-p quantum_us]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (conns < 1 || rounds < 1 || msgsize < 1 || msgsize > MAX_MSG) {
+        fprintf(stderr, "echo_bench: bad arguments\n");
+        return 1;
+    }
+    rtt = malloc((size_t)conns * rounds * sizeof(long));
+    if (rtt == NULL) {
+        perror("echo_bench: malloc");
+        return 1;
+    }
+
+    lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (lfd == -1 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr))
+        == -1 || listen(lfd, SOMAXCONN) == -1
+        || getsockname(lfd, (struct sockaddr *)&addr, &len) == -1) {
+        perror("echo_bench: listen");
+        return 1;
+    }
+    /* an ephemeral port on 127.0.0.1 */
+
+    lwp_start();
+    if (quantum > 0 && lwp_preempt(quantum) == -1) {
+        return 1;
+    }
+
+    lwp_attr attr = { ECHO_STACK, NULL, 0, 0 };
+    tid_t acc = lwp_create_ex(acceptor, (void *)(long)lfd, &attr);
+    tid_t *clients = malloc(conns * sizeof(tid_t));
+    long start = lwp_now_ns();
+    for (i = 0; i < conns; i++) {
+        clients[i] = lwp_create_ex(client, (void *)i, &attr);
+    }
+    for (i = 0; i < conns; i++) {
+        lwp_join(clients[i], NULL);
+    }
+    long elapsed = lwp_now_ns() - start;
+    lwp_join(acc, NULL);
+    lwp_close(lfd);
+
+    if (failures > 0) {
+        fprintf(stderr, "echo_bench: %ld clients failed\n", failures);
+        return 1;
+    }
+    long total = (long)conns * rounds;
+    qsort(rtt, total, sizeof(long), cmp_long);
+    printf("%-8s %8s %12s %10s %10s %10s\n", "conns", "msgsize",
+           "rtt/s", "p50(us)", "p99(us)", "max(us)");
+    printf("%-8d %8zu %12.0f %10.1f %10.1f %10.1f\n", conns, msgsize,
+           total / (elapsed / 1e9), rtt[total / 2] / 1e3,
+           rtt[total * 99 / 100] / 1e3, rtt[total - 1] / 1e3);
+    free(clients);
+    free(rtt);
+    return 0;
+}
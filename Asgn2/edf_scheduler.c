@@ -0,0 +1,227 @@
+/*
+ * Description: This file contains the earliest-deadline-first scheduler.
+ *              Threads given a deadline with lwp_set_deadline() are kept
+ *              in a min-heap (heap.c) by deadline and always run before
+ *              the rest, which take turns round-robin. Deadlines that pass
+ *              before the thread is done are counted.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include "schedulers.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static Heap *urgent = NULL;       /* threads with a deadline */
+static Queue *others = NULL;      /* and without, in RR order */
+static unsigned long misses = 0;
+
+static struct scheduler edf_tuple = {
+    edf_init, edf_shutdown, edf_admit, edf_remove, edf_next, edf_qlen,
+    edf_drain, NULL
+};
+scheduler EarliestDeadline = &edf_tuple;
+
+/*
+ * Description:
+ *   Counts a thread's deadline as missed if it has passed, once.
+ * Parameters:
+ *   The thread and the current time.
+ * Returns:
+ *   Nothing.
+ */
+static void check_late(thread t, unsigned long now) {
+    if (t->deadline != 0 && now > t->deadline && !(t->flags & LWP_LATE)) {
+        t->flags |= LWP_LATE;
+        t->missed++;
+        misses++;
+    }
+}
+
+/*
+ * Description:
+ *   Initializes the EDF scheduler.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void edf_init(void) {
+    if (urgent == NULL) {
+        urgent = heap_new();
+    }
+    if (others == NULL) {
+        others = startup(FALSE);
+    }
+}
+
+/*
+ * Description:
+ *   Shuts down the EDF scheduler.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void edf_shutdown(void) {
+    if (edf_qlen() != 0) {
+        return;
+    }
+    if (urgent != NULL) {
+        heap_free(urgent);
+        urgent = NULL;
+    }
+    if (others != NULL) {
+        shutdown(others);
+        others = NULL;
+    }
+}
+
+/*
+ * Description:
+ *   Adds a thread: by deadline if it has one, else at the back of
+ *   the round-robin class.
+ * Parameters:
+ *   The new thread to add.
+ * Returns:
+ *   Nothing.
+ */
+void edf_admit(thread new) {
+    if (new == NULL) {
+        perror("cannot add NULL thread");
+        return;
+    }
+    if (urgent == NULL || others == NULL) {
+        edf_init();
+    }
+    if (urgent == NULL || others == NULL) {
+        return;
+    }
+    if (new->deadline != 0) {
+        new->sched_key = new->deadline;
+        heap_push(urgent, new);
+    } else {
+        enqueue(others, new, FALSE);
+    }
+}
+
+/*
+ * Description:
+ *   Removes a thread from the scheduler.
+ * Parameters:
+ *   The thread to remove.
+ * Returns:
+ *   Nothing.
+ */
+void edf_remove(thread victim) {
+    if (victim == NULL) {
+        perror("cannot remove NULL thread");
+        return;
+    }
+    if (urgent != NULL && inheap(urgent, victim)) {
+        heap_remove(urgent, victim);
+    } else if (others != NULL) {
+        dequeue(others, victim, FALSE);
+    }
+}
+
+/*
+ * Description:
+ *   Gets the next thread to run.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The thread with the earliest deadline, else the next round-robin
+ *   thread, or NULL if there are none.
+ */
+thread edf_next(void) {
+    thread t = (urgent != NULL) ? heap_peek(urgent) : NULL;
+    if (t != NULL) {
+        check_late(t, lwp_now_ns());
+        return t;
+    }
+    if (others == NULL || others->length == 0) {
+        return NULL;
+    }
+    return others->sen->sched_one;
+}
+
+/*
+ * Description:
+ *   Retrieves the number of runnable threads.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The number of runnable threads.
+ */
+int edf_qlen(void) {
+    return ((urgent != NULL) ? urgent->length : 0)
+           + ((others != NULL) ? others->length : 0);
+}
+
+/*
+ * Description:
+ *   Moves every runnable thread onto a queue: those with deadlines
+ *   first, then the round-robin class in order.
+ * Parameters:
+ *   The queue to add them to.
+ * Returns:
+ *   Nothing.
+ */
+void edf_drain(Queue *out) {
+    if (urgent != NULL) {
+        heap_drain(urgent, out);
+    }
+    if (others != NULL) {
+        splice(out, others);
+    }
+}
+
+/*
+ * Description:
+ *   Gives a thread a new deadline, or takes its deadline away. The old
+ *   one is counted as missed if it has already passed.
+ * Parameters:
+ *   The tid, and the deadline as CLOCK_MONOTONIC nanoseconds (0 for
+ *   none: the thread goes to the round-robin class).
+ * Returns:
+ *   0 on success, -1 if there is no such thread.
+ */
+int lwp_set_deadline(tid_t tid, unsigned long abs_ns) {
+    thread t = tid2thread(tid);
+    if (t == NULL) {
+        return -1;
+    }
+    int was = preempt_enter();
+    check_late(t, lwp_now_ns());
+
+    int queued = (urgent != NULL && inheap(urgent, t))
+                 || (others != NULL && inqueue(others, t, FALSE));
+    if (queued) {
+        edf_remove(t);
+    }
+    t->deadline = abs_ns;
+    t->flags &= ~LWP_LATE;
+    if (queued) {
+        edf_admit(t);
+    }
+    preempt_leave(was);
+    return 0;
+}
+
+/*
+ * Description:
+ *   Reports missed deadlines.
+ * Parameters:
+ *   A tid, or NO_THREAD for every thread ever.
+ * Returns:
+ *   How many deadlines it has missed.
+ */
+unsigned long lwp_deadline_misses(tid_t tid) {
+    if (tid == NO_THREAD) {
+        return misses;
+    }
+    thread t = tid2thread(tid);
+    return (t != NULL) ? t->missed : 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * Description: This file contains the fair scheduler. It runs the thread
+ *              that has had the least CPU time (its virtual runtime), as
+ *              measured by the library's run-time accounting, so a thread
+ *              that runs long between yields gets fewer turns than one
+ *              that yields quickly. Runnable threads are kept in a min-heap
+ *              (heap.c) keyed by virtual runtime.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include "schedulers.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FAIR_MAX_LAG 100000000UL   /* ns a thread may trail min_vruntime */
+
+static Heap *tree = NULL;
+static unsigned long min_vruntime = 0;  /* never goes backwards */
+static int owns_accounting = FALSE;
+
+static struct scheduler fair_tuple = {
+    fair_init, fair_shutdown, fair_admit, fair_remove, fair_next, fair_qlen,
+    fair_drain, fair_admit_batch
+};
+scheduler Fair = &fair_tuple;
+
+/*
+ * Description:
+ *   Adds whatever a thread has run since it was last charged to its
+ *   virtual runtime (sched_key). sched_mark is the runtime already
+ *   counted.
+ * Parameters:
+ *   The thread.
+ * Returns:
+ *   Nothing.
+ */
+static void charge(thread t) {
+    t->sched_key += t->runtime - t->sched_mark;
+    t->sched_mark = t->runtime;
+}
+
+/*
+ * Description:
+ *   Initializes the fair scheduler and turns on accounting.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void fair_init(void) {
+    if (tree == NULL) {
+        tree = heap_new();
+    }
+    if (tree != NULL && lwp_account(TRUE) == FALSE) {
+        owns_accounting = TRUE;
+    }
+}
+
+/*
+ * Description:
+ *   Shuts down the fair scheduler, turning accounting back off if it
+ *   was the one that turned it on.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void fair_shutdown(void) {
+    if (tree != NULL && tree->length == 0) {
+        heap_free(tree);
+        tree = NULL;
+        if (owns_accounting) {
+            lwp_account(FALSE);
+            owns_accounting = FALSE;
+        }
+    }
+}
+
+/*
+ * Description:
+ *   Adds a thread. Its virtual runtime is brought up to date and then
+ *   clamped to at least min_vruntime, so a new thread or one that has
+ *   been blocked a long time cannot starve everyone else to catch up.
+ *   One that was only taken out for lwp_yield()'s rotation is already
+ *   above it and is unaffected. It is also clamped to at most
+ *   FAIR_MAX_LAG past min_vruntime: a thread that blocked under another
+ *   policy wakes with that policy's key (a deadline, a pass), which
+ *   would otherwise keep it from ever running here.
+ * Parameters:
+ *   The new thread to add.
+ * Returns:
+ *   Nothing.
+ */
+void fair_admit(thread new) {
+    if (new == NULL) {
+        perror("cannot add NULL thread");
+        return;
+    }
+    if (tree == NULL) {
+        fair_init();
+    }
+    if (tree == NULL) {
+        return;
+    }
+    charge(new);
+    if (new->sched_key < min_vruntime) {
+        new->sched_key = min_vruntime;
+    } else if (new->sched_key - min_vruntime > FAIR_MAX_LAG) {
+        new->sched_key = min_vruntime + FAIR_MAX_LAG;
+    }
+    heap_push(tree, new);
+}
+
+/*
+ * Description:
+ *   Adds every thread on a queue, as lwp_set_scheduler does when
+ *   switching to Fair. Their sched_key belongs to the old policy, so
+ *   each starts over at min_vruntime with nothing left to charge.
+ * Parameters:
+ *   The queue of threads to add; it is left empty.
+ * Returns:
+ *   Nothing.
+ */
+void fair_admit_batch(Queue *in) {
+    if (tree == NULL) {
+        fair_init();
+    }
+    if (tree == NULL) {
+        perror("error initializing fair scheduler");
+        return;
+    }
+    while (in->length > 0) {
+        thread t = in->sen->sched_one;
+        dequeue(in, t, FALSE);
+        t->sched_key = min_vruntime;
+        t->sched_mark = t->runtime;
+        heap_push(tree, t);
+    }
+}
+
+/*
+ * Description:
+ *   Removes a thread from the scheduler.
+ * Parameters:
+ *   The thread to remove.
+ * Returns:
+ *   Nothing.
+ */
+void fair_remove(thread victim) {
+    if (victim == NULL) {
+        perror("cannot remove NULL thread");
+        return;
+    }
+    if (tree != NULL) {
+        heap_remove(tree, victim);
+    }
+}
+
+/*
+ * Description:
+ *   Gets the next thread to run. The calling thread has just been
+ *   charged by the library, so it is re-sorted first.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The thread with the least virtual runtime, or NULL if there are
+ *   none.
+ */
+thread fair_next(void) {
+    if (tree == NULL) {
+        return NULL;
+    }
+    thread self = running;
+    if (self != NULL && inheap(tree, self)) {
+        charge(self);
+        heap_fix(tree, self);
+    }
+    thread t = heap_peek(tree);
+    if (t != NULL && t->sched_key > min_vruntime) {
+        min_vruntime = t->sched_key;
+    }
+    return t;
+}
+
+/*
+ * Description:
+ *   Retrieves the number of runnable threads.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The number of runnable threads.
+ */
+int fair_qlen(void) {
+    return (tree != NULL) ? tree->length : 0;
+}
+
+/*
+ * Description:
+ *   Moves every runnable thread onto a queue.
+ * Parameters:
+ *   The queue to add them to.
+ * Returns:
+ *   Nothing.
+ */
+void fair_drain(Queue *out) {
+    if (tree != NULL) {
+        heap_drain(tree, out);
+    }
+}
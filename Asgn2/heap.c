@@ -0,0 +1,219 @@
+/*
+ * Description: This file contains a binary min-heap of threads ordered by
+ *              sched_key, for schedulers that pick by pass, virtual
+ *              runtime or deadline. Each thread's index is kept in
+ *              sched_slot so it can be removed or re-keyed in O(log n).
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HEAP_MIN 64
+
+/*
+ * Description:
+ *   Puts a thread at an index and records the index in it.
+ * Parameters:
+ *   The heap, the index and the thread.
+ * Returns:
+ *   Nothing.
+ */
+static void place(Heap *h, int i, thread t) {
+    h->items[i] = t;
+    t->sched_slot = i;
+}
+
+/*
+ * Description:
+ *   Moves the thread at an index up until its parent is not larger.
+ * Parameters:
+ *   The heap and the index.
+ * Returns:
+ *   Nothing.
+ */
+static void sift_up(Heap *h, int i) {
+    thread t = h->items[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (h->items[parent]->sched_key <= t->sched_key) {
+            break;
+        }
+        place(h, i, h->items[parent]);
+        i = parent;
+    }
+    place(h, i, t);
+}
+
+/*
+ * Description:
+ *   Moves the thread at an index down until neither child is smaller.
+ * Parameters:
+ *   The heap and the index.
+ * Returns:
+ *   Nothing.
+ */
+static void sift_down(Heap *h, int i) {
+    thread t = h->items[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= h->length) {
+            break;
+        }
+        if (child + 1 < h->length
+            && h->items[child + 1]->sched_key < h->items[child]->sched_key) {
+            child++;
+        }
+        if (t->sched_key <= h->items[child]->sched_key) {
+            break;
+        }
+        place(h, i, h->items[child]);
+        i = child;
+    }
+    place(h, i, t);
+}
+
+/*
+ * Description:
+ *   Creates an empty heap.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The heap, or NULL on error.
+ */
+Heap *heap_new(void) {
+    Heap *h = malloc(sizeof(Heap));
+    if (h == NULL) {
+        perror("error allocating heap");
+        return NULL;
+    }
+    h->items = malloc(HEAP_MIN * sizeof(thread));
+    if (h->items == NULL) {
+        perror("error allocating heap");
+        free(h);
+        return NULL;
+    }
+    h->length = 0;
+    h->cap = HEAP_MIN;
+    return h;
+}
+
+/*
+ * Description:
+ *   Frees a heap (not the threads on it).
+ * Parameters:
+ *   The heap.
+ * Returns:
+ *   Nothing.
+ */
+void heap_free(Heap *h) {
+    free(h->items);
+    free(h);
+}
+
+/*
+ * Description:
+ *   Tells whether a thread is on a heap.
+ * Parameters:
+ *   The heap and the thread.
+ * Returns:
+ *   TRUE or FALSE.
+ */
+int inheap(Heap *h, thread t) {
+    return t->sched_slot < (unsigned long)h->length
+           && h->items[t->sched_slot] == t;
+}
+
+/*
+ * Description:
+ *   Adds a thread, ordered by its current sched_key.
+ * Parameters:
+ *   The heap and the thread.
+ * Returns:
+ *   0 on success, -1 if the heap cannot grow.
+ */
+int heap_push(Heap *h, thread t) {
+    if (h->length == h->cap) {
+        thread *grown = realloc(h->items, 2 * h->cap * sizeof(thread));
+        if (grown == NULL) {
+            perror("error growing heap");
+            return -1;
+        }
+        h->items = grown;
+        h->cap *= 2;
+    }
+    place(h, h->length++, t);
+    sift_up(h, h->length - 1);
+    return 0;
+}
+
+/*
+ * Description:
+ *   Removes a thread from a heap. Does nothing if it is not there.
+ * Parameters:
+ *   The heap and the thread.
+ * Returns:
+ *   Nothing.
+ */
+void heap_remove(Heap *h, thread t) {
+    if (inheap(h, t) == FALSE) {
+        return;
+    }
+    int i = t->sched_slot;
+    thread last = h->items[--h->length];
+    t->sched_slot = ~0UL;
+    if (last == t) {
+        return;
+    }
+    place(h, i, last);
+    heap_fix(h, last);
+}
+
+/*
+ * Description:
+ *   Restores the order after a thread's sched_key has changed.
+ * Parameters:
+ *   The heap and the thread (which must be on it).
+ * Returns:
+ *   Nothing.
+ */
+void heap_fix(Heap *h, thread t) {
+    int i = t->sched_slot;
+    if (i > 0 && h->items[(i - 1) / 2]->sched_key > t->sched_key) {
+        sift_up(h, i);
+    } else {
+        sift_down(h, i);
+    }
+}
+
+/*
+ * Description:
+ *   Empties a heap onto the end of a queue. The threads go in heap
+ *   order, which only roughly follows their keys.
+ * Parameters:
+ *   The heap and the queue.
+ * Returns:
+ *   Nothing.
+ */
+void heap_drain(Heap *h, Queue *out) {
+    int i;
+    for (i = 0; i < h->length; i++) {
+        h->items[i]->sched_slot = ~0UL;
+        enqueue(out, h->items[i], FALSE);
+    }
+    h->length = 0;
+}
+
+/*
+ * Description:
+ *   Looks at the thread with the smallest key.
+ * Parameters:
+ *   The heap.
+ * Returns:
+ *   That thread, or NULL if the heap is empty.
+ */
+thread heap_peek(Heap *h) {
+    return (h->length > 0) ? h->items[0] : NULL;
+}
@@ -0,0 +1,508 @@
+/*
+ * Description: This file contains the LWP I/O wrappers and the epoll
+ *              reactor behind them. The wrappers put descriptors in
+ *              non-blocking mode and try the call; on EAGAIN the caller
+ *              is parked on the descriptor's reader or writer wait list
+ *              (see sync.c) and the descriptor is armed, one-shot, in
+ *              the library's epoll set. lwp_yield() runs the reactor
+ *              when the run queue drains, sleeping in epoll until a
+ *              descriptor is ready or the next timer is due, and now
+ *              and then (without sleeping) while threads are runnable.
+ *              Ready descriptors wake all their waiters, which retry.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#define shutdown sock_shutdown  /* lwp.h has a shutdown() of its own */
+#include <sys/socket.h>
+#undef shutdown
+#include "lwp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FD_CHUNK      256       /* fdwaits per table chunk         */
+#define IO_EVENTS     64        /* epoll events taken per call     */
+#define IO_POLL_EVERY 64        /* yields between non-blocking polls */
+
+/* What the library knows about one descriptor. Kept in chunks that
+ * never move, since parked threads point at the wait lists.
+ */
+typedef struct fdwait {
+    lwp_waitlist readers;
+    lwp_waitlist writers;
+    lwp_waitlist pollers;       /* lwp_poll_fd(): woken by anything */
+    unsigned int pollev;        /* and the epoll events they want   */
+    int          nonblock;      /* we set O_NONBLOCK on it          */
+    int          added;         /* it is in the epoll set           */
+    int          fd;
+} fdwait;
+
+static fdwait **chunks = NULL;
+static int nchunks = 0;
+static int epfd = -1;
+static long waiting = 0;        /* threads parked on descriptors */
+static unsigned long polls = 0;
+
+/*
+ * Description:
+ *   Finds a descriptor's entry, making room for it if need be.
+ * Parameters:
+ *   The descriptor.
+ * Returns:
+ *   The entry, or NULL (errno set) if fd is negative or out of memory.
+ */
+static fdwait *fd_entry(int fd) {
+    if (fd < 0) {
+        errno = EBADF;
+        return NULL;
+    }
+    int c = fd / FD_CHUNK;
+    if (c >= nchunks) {
+        int n = nchunks ? nchunks : 4;
+        while (n <= c) {
+            n *= 2;
+        }
+        fdwait **grown = realloc(chunks, n * sizeof(fdwait *));
+        if (grown == NULL) {
+            return NULL;
+        }
+        memset(grown + nchunks, 0, (n - nchunks) * sizeof(fdwait *));
+        chunks = grown;
+        nchunks = n;
+    }
+    if (chunks[c] == NULL) {
+        chunks[c] = calloc(FD_CHUNK, sizeof(fdwait));
+        if (chunks[c] == NULL) {
+            return NULL;
+        }
+        int i;
+        for (i = 0; i < FD_CHUNK; i++) {
+            chunks[c][i].fd = c * FD_CHUNK + i;
+        }
+    }
+    return &chunks[c][fd % FD_CHUNK];
+}
+
+/*
+ * Description:
+ *   Looks up a descriptor and makes sure it is non-blocking.
+ * Parameters:
+ *   The descriptor.
+ * Returns:
+ *   Its entry, or NULL with errno set.
+ */
+static fdwait *fd_prepare(int fd) {
+    fdwait *fw = fd_entry(fd);
+    if (fw == NULL || fw->nonblock) {
+        return fw;
+    }
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1) {
+        return NULL;
+    }
+    if (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK)
+        == -1) {
+        return NULL;
+    }
+    fw->nonblock = TRUE;
+    return fw;
+}
+
+/*
+ * Description:
+ *   Arms a descriptor in the epoll set for whatever its waiters want.
+ *   One-shot, so it is armed again each time someone parks on it.
+ * Parameters:
+ *   The entry and the epoll events of a waiter about to be added.
+ * Returns:
+ *   0, or -1 with errno set.
+ */
+static int fd_arm(fdwait *fw, unsigned int more) {
+    struct epoll_event ev;
+    if (epfd == -1) {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd == -1) {
+            perror("error creating epoll set");
+            return -1;
+        }
+    }
+    ev.events = EPOLLONESHOT | more;
+    if (fw->readers.head != NULL) {
+        ev.events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (fw->writers.head != NULL) {
+        ev.events |= EPOLLOUT;
+    }
+    if (fw->pollers.head != NULL) {
+        ev.events |= fw->pollev;
+    }
+    ev.data.ptr = fw;
+    if (fw->added) {
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, fw->fd, &ev) == 0) {
+            return 0;
+        }
+        if (errno != ENOENT) {
+            return -1;
+        }
+        /* closed behind our back and since reused */
+    }
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fw->fd, &ev) == -1) {
+        return -1;
+    }
+    fw->added = TRUE;
+    return 0;
+}
+
+/*
+ * Description:
+ *   Parks the calling thread until a descriptor may be ready. Must be
+ *   called inside preempt_enter().
+ * Parameters:
+ *   The entry, the list to wait on, the epoll events that should wake
+ *   it and a CLOCK_MONOTONIC deadline in ns, or 0 for none.
+ * Returns:
+ *   0 once woken (the descriptor may still not be ready, so retry),
+ *   LWP_TIMEDOUT, or -1 with errno set.
+ */
+static int fd_wait(fdwait *fw, lwp_waitlist *w, unsigned int events,
+                   unsigned long abs_ns) {
+    if (fd_arm(fw, events) == -1) {
+        return -1;
+    }
+    waiting++;
+    int ret = wait_until(w, abs_ns);
+    waiting--;
+    return ret;
+}
+
+/*
+ * Description:
+ *   Wakes everyone waiting on a list.
+ * Parameters:
+ *   The list.
+ * Returns:
+ *   Nothing.
+ */
+static void wake_all(lwp_waitlist *w) {
+    while (wake_one(w) != NULL) {
+    }
+}
+
+/*
+ * Description:
+ *   Takes what the epoll set has to report and wakes the waiters on
+ *   each ready descriptor. A descriptor that still has waiters in the
+ *   other direction is armed again for them.
+ * Parameters:
+ *   How long to wait, in ns: 0 to just look, -1 for as long as it
+ *   takes.
+ * Returns:
+ *   The number of descriptors reported.
+ */
+static int reactor(long wait_ns) {
+    struct epoll_event evs[IO_EVENTS];
+    int n;
+    if (wait_ns < 0) {
+        n = epoll_wait(epfd, evs, IO_EVENTS, -1);
+    } else {
+        struct timespec ts;
+        ts.tv_sec = wait_ns / 1000000000L;
+        ts.tv_nsec = wait_ns % 1000000000L;
+        n = epoll_pwait2(epfd, evs, IO_EVENTS, &ts, NULL);
+        if (n == -1 && errno == ENOSYS) {
+            n = epoll_wait(epfd, evs, IO_EVENTS,
+                           (int)((wait_ns + 999999) / 1000000));
+        }
+        /* before Linux 5.11, in whole milliseconds */
+    }
+    if (n < 0) {
+        return 0;
+        /* EINTR: a preemption tick; the caller looks again */
+    }
+
+    int i;
+    for (i = 0; i < n; i++) {
+        fdwait *fw = evs[i].data.ptr;
+        unsigned int e = evs[i].events;
+        if (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            wake_all(&fw->readers);
+        }
+        if (e & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            wake_all(&fw->writers);
+        }
+        wake_all(&fw->pollers);
+        fw->pollev = 0;
+        if (fw->readers.head != NULL || fw->writers.head != NULL) {
+            fd_arm(fw, 0);
+        }
+    }
+    return n;
+}
+
+/*
+ * Description:
+ *   Polls the epoll set without sleeping every IO_POLL_EVERY calls,
+ *   so threads waiting on descriptors are not starved by ones that
+ *   never stop running. Cheap when nobody is waiting.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void io_poll(void) {
+    if (waiting > 0 && ++polls % IO_POLL_EVERY == 0) {
+        reactor(0);
+    }
+}
+
+/*
+ * Description:
+ *   Tells how many threads are parked on descriptors.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The count.
+ */
+long io_waiting(void) {
+    return waiting;
+}
+
+/*
+ * Description:
+ *   Sleeps the whole process until a descriptor someone waits on is
+ *   ready or the next timer is due, and wakes whoever that was for.
+ *   For when no thread is runnable.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   0, or -1 if nothing is waited on and no timer is armed (nothing
+ *   would ever wake).
+ */
+int io_idle(void) {
+    if (waiting == 0) {
+        return timer_idle();
+    }
+    reactor(timer_wait_ns());
+    timer_poll();
+    return 0;
+}
+
+/*
+ * Description:
+ *   Reads like read(2), parking the calling thread instead of the
+ *   process until there is something to read.
+ * Parameters:
+ *   As read(2).
+ * Returns:
+ *   As read(2).
+ */
+ssize_t lwp_read(int fd, void *buf, size_t count) {
+    int was = preempt_enter();
+    ssize_t ret = -1;
+    fdwait *fw = fd_prepare(fd);
+    while (fw != NULL) {
+        ret = read(fd, buf, count);
+        if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            break;
+        }
+        if (fd_wait(fw, &fw->readers, EPOLLIN | EPOLLRDHUP, 0) == -1) {
+            ret = -1;
+            break;
+        }
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Writes like write(2) to a blocking descriptor: parks the calling
+ *   thread instead of the process until all of it is written.
+ * Parameters:
+ *   As write(2).
+ * Returns:
+ *   count, or -1 with errno set (after a partial write too).
+ */
+ssize_t lwp_write(int fd, const void *buf, size_t count) {
+    int was = preempt_enter();
+    ssize_t ret = -1;
+    size_t done = 0;
+    fdwait *fw = fd_prepare(fd);
+    while (fw != NULL) {
+        ret = write(fd, (const char *)buf + done, count - done);
+        if (ret >= 0) {
+            done += ret;
+            if (done == count) {
+                ret = count;
+                break;
+            }
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            break;
+        }
+        if (fd_wait(fw, &fw->writers, EPOLLOUT, 0) == -1) {
+            ret = -1;
+            break;
+        }
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Accepts a connection like accept(2), parking the calling thread
+ *   until one arrives. The new descriptor is non-blocking, ready for
+ *   the other wrappers.
+ * Parameters:
+ *   As accept(2).
+ * Returns:
+ *   As accept(2).
+ */
+int lwp_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+    int was = preempt_enter();
+    int ret = -1;
+    fdwait *fw = fd_prepare(fd);
+    while (fw != NULL) {
+        ret = accept(fd, addr, addrlen);
+        if (ret >= 0) {
+            if (fd_prepare(ret) == NULL) {
+                close(ret);
+                ret = -1;
+            }
+            break;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK
+            && errno != ECONNABORTED) {
+            break;
+        }
+        if (fd_wait(fw, &fw->readers, EPOLLIN, 0) == -1) {
+            break;
+        }
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Connects a socket like connect(2), parking the calling thread
+ *   until the connection is made or fails.
+ * Parameters:
+ *   As connect(2).
+ * Returns:
+ *   As connect(2).
+ */
+int lwp_connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+    int was = preempt_enter();
+    int ret = -1;
+    fdwait *fw = fd_prepare(fd);
+    if (fw != NULL) {
+        ret = connect(fd, addr, addrlen);
+        if (ret == -1 && errno == EINPROGRESS) {
+            int err = 0, n;
+            socklen_t len = sizeof(err);
+            struct pollfd p = { fd, POLLOUT, 0 };
+            while ((n = poll(&p, 1, 0)) == 0) {
+                if (fd_wait(fw, &fw->writers, EPOLLOUT, 0) == -1) {
+                    n = -1;
+                    break;
+                }
+            }
+            /* writable once it has connected or failed. if the wait
+               itself failed, the connect is still in progress and
+               errno already says why */
+            if (n > 0 && !(p.revents & (POLLOUT | POLLERR | POLLHUP))) {
+                errno = EBADF;
+            } else if (n > 0 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err,
+                                           &len) == 0) {
+                if (err == 0) {
+                    ret = 0;
+                } else {
+                    errno = err;
+                }
+            }
+        }
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Waits for a descriptor to be ready, parking the calling thread.
+ * Parameters:
+ *   The descriptor, the poll(2) events wanted (POLLIN and/or POLLOUT)
+ *   and a CLOCK_MONOTONIC deadline in ns, or 0 for none.
+ * Returns:
+ *   The poll(2) revents, 0 at the deadline, or -1 with errno set.
+ */
+int lwp_poll_fd(int fd, short events, unsigned long abs_ns) {
+    int was = preempt_enter();
+    int ret = -1;
+    fdwait *fw = fd_prepare(fd);
+    while (fw != NULL) {
+        struct pollfd p = { fd, events, 0 };
+        ret = poll(&p, 1, 0);
+        if (ret != 0) {
+            ret = (ret > 0) ? p.revents : -1;
+            break;
+        }
+        /* see for ourselves: a wake is only a hint */
+        unsigned int want = 0;
+        if (events & POLLIN) {
+            want |= EPOLLIN | EPOLLRDHUP;
+        }
+        if (events & POLLOUT) {
+            want |= EPOLLOUT;
+        }
+        fw->pollev |= want;
+        int w = fd_wait(fw, &fw->pollers, want, abs_ns);
+        if (w == LWP_TIMEDOUT) {
+            ret = 0;
+            break;
+        } else if (w == -1) {
+            break;
+        }
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Closes a descriptor the wrappers have used, forgetting what the
+ *   library knew about it and waking anyone still waiting on it (who
+ *   will then fail with EBADF). Use this rather than close(2) on
+ *   descriptors that may be reused.
+ * Parameters:
+ *   The descriptor.
+ * Returns:
+ *   As close(2).
+ */
+int lwp_close(int fd) {
+    int was = preempt_enter();
+    fdwait *fw = fd_entry(fd);
+    if (fw != NULL) {
+        if (fw->added) {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+        }
+        fw->added = FALSE;
+        fw->nonblock = FALSE;
+        wake_all(&fw->readers);
+        wake_all(&fw->writers);
+        wake_all(&fw->pollers);
+        fw->pollev = 0;
+    }
+    int ret = close(fd);
+    preempt_leave(was);
+    return ret;
+}
@@ -5,23 +5,61 @@
  */
 
 #define DEFAULT_STACK 8388608
+#define MIN_STACK 16384
 #define BOUND 16
 #define BYTES 8
+#define MXCSR_INIT 0x1f80
+#define FCW_INIT 0x037f
+#define ALTSTACK 65536
+#define COPIER_STACK 65536
+#define TID_GENSHIFT 32
+#define TID_SLOTMASK 0xffffffffu
+#define TID_MIN 64
 
 #include "lwp.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
 #include <sys/resource.h>
-#include <sys/mman.h>
 
 long stacksize = -1;
-unsigned long threads = 0;
+long pagesize = -1;
 thread running = NULL;
 Queue *all = NULL;
 Queue *zombie = NULL;
 Queue *blocked = NULL;
 
+static char altstack[ALTSTACK];
+static struct sigaction oldsegv;
+static int segv_installed = FALSE;
+
+/* tid table: a tid is (generation << TID_GENSHIFT) | slot. A slot is
+   reused once its thread is reaped, with its generation bumped so that
+   stale tids stop matching. Slot 0 is never used (NO_THREAD). */
+typedef struct tidslot {
+    thread t;                   /* or NULL when free     */
+    unsigned int gen;
+    unsigned int next;          /* free list, 0 for end  */
+} tidslot;
+
+static tidslot *tids = NULL;
+static unsigned int tidcap = 0;    /* slots allocated       */
+static unsigned int tidused = 1;   /* slots ever handed out */
+static unsigned int tidfree = 0;   /* head of the free list */
+
+static int accounting = FALSE;  /* keep thread->runtime up to date */
+
+static context copier;          /* moves frames on/off shared stacks */
+static thread copy_to = NULL;
+
+static thread dead = NULL;      /* detached, exited, not yet reclaimed */
+
+static void yield(void);
+static void bury(void);
+static int reclaim(thread delete);
 
 /*
  * Description:
@@ -33,10 +71,164 @@ Queue *blocked = NULL;
  *   Nothing.
  */
 static void lwp_wrap(lwpfun fun, void *arg) {
+    bury();
+    preempt_leave(FALSE);
+    /* it was switched to from inside the library */
     int rval = fun(arg);
     lwp_exit(rval);
 }
 
+/*
+ * Description:
+ *   Reads the monotonic clock. Run-time accounting, deadlines and
+ *   timers all use it, and callers should build abs_ns arguments
+ *   from it.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   CLOCK_MONOTONIC in nanoseconds.
+ */
+unsigned long lwp_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+ * Description:
+ *   Gives a thread a tid, preferring a slot freed by a reaped thread.
+ * Parameters:
+ *   The thread.
+ * Returns:
+ *   Its new tid, or NO_THREAD if the table cannot grow.
+ */
+static tid_t tid_alloc(thread t) {
+    unsigned int slot = tidfree;
+    if (slot != 0) {
+        tidfree = tids[slot].next;
+    } else {
+        if (tidused == TID_SLOTMASK) {
+            perror("out of thread ids");
+            return NO_THREAD;
+        }
+        if (tidused >= tidcap) {
+            unsigned int cap = (tidcap == 0) ? TID_MIN : tidcap * 2;
+            tidslot *grown = realloc(tids, cap * sizeof(tidslot));
+            if (grown == NULL) {
+                perror("error growing tid table");
+                return NO_THREAD;
+            }
+            tids = grown;
+            tidcap = cap;
+        }
+        slot = tidused++;
+        tids[slot].gen = 0;
+    }
+    tids[slot].t = t;
+    return ((tid_t)tids[slot].gen << TID_GENSHIFT) | slot;
+}
+
+/*
+ * Description:
+ *   Frees a reaped thread's tid slot for reuse.
+ * Parameters:
+ *   The tid.
+ * Returns:
+ *   Nothing.
+ */
+static void tid_release(tid_t tid) {
+    unsigned int slot = tid & TID_SLOTMASK;
+    tids[slot].t = NULL;
+    tids[slot].gen++;
+    tids[slot].next = tidfree;
+    tidfree = slot;
+}
+
+/*
+ * Description:
+ *   SIGSEGV handler, run on the alternate signal stack since the
+ *   faulting thread's stack is the thing that ran out. If the fault
+ *   hit a guard page it reports which thread overflowed. Either way it
+ *   puts the previous action back and returns, so the fault repeats
+ *   and is handled (or dumps core) as it would have without us.
+ * Parameters:
+ *   The signal, its info, and the interrupted context (unused).
+ * Returns:
+ *   Nothing.
+ */
+static void overflow_handler(int sig, siginfo_t *info, void *uc) {
+    thread t = NULL;
+    char msg[64], num[24];
+    int len = 0, n = 0;
+    tid_t tid;
+
+    (void)sig;
+    (void)uc;
+    if (running != NULL && running->stack != NULL
+        && !(running->flags & LWP_USERSTACK)
+        && stack_in_guard(running->stack, info->si_addr)) {
+        t = running;
+    } else if (all != NULL) {
+        thread cur = all->sen->lib_one;
+        while (cur != all->sen && t == NULL) {
+            if (cur->stack != NULL && !(cur->flags & LWP_USERSTACK)
+                && stack_in_guard(cur->stack, info->si_addr)) {
+                t = cur;
+            }
+            cur = cur->lib_one;
+        }
+    }
+    /* usually the running thread, but check everyone */
+
+    if (t != NULL) {
+        tid = t->tid;
+        do {
+            num[n++] = '0' + tid % 10;
+            tid /= 10;
+        } while (tid > 0);
+        memcpy(msg, "lwp: thread ", 12);
+        len = 12;
+        while (n > 0) {
+            msg[len++] = num[--n];
+        }
+        memcpy(msg + len, " overflowed its stack\n", 22);
+        len += 22;
+        write(STDERR_FILENO, msg, len);
+    }
+    /* stdio is not safe here, so build the message by hand */
+
+    sigaction(SIGSEGV, &oldsegv, NULL);
+}
+
+/*
+ * Description:
+ *   Installs overflow_handler on an alternate signal stack. Only done
+ *   once; a failure just means overflows are not reported.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+static void install_overflow_handler(void) {
+    stack_t ss;
+    struct sigaction sa;
+
+    segv_installed = TRUE;
+    ss.ss_sp = altstack;
+    ss.ss_size = ALTSTACK;
+    ss.ss_flags = 0;
+    if (sigaltstack(&ss, NULL) == -1) {
+        perror("sigaltstack");
+        return;
+    }
+    sa.sa_sigaction = overflow_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    if (sigaction(SIGSEGV, &sa, &oldsegv) == -1) {
+        perror("sigaction");
+    }
+}
+
 /*
  * Description:
  *   Checks to make sure resources exist and
@@ -76,6 +268,9 @@ int check_init(void) {
         perror("error initializing rr scheduler");
         return -1;
     }
+    if (segv_installed == FALSE) {
+        install_overflow_handler();
+    }
     return 0;
 }
 
@@ -93,6 +288,7 @@ int set_stack_size(void) {
         perror("sysconf");
         return -1;
     }
+    pagesize = pgsize;
     struct rlimit rlim;
     if (getrlimit(RLIMIT_STACK, &rlim) == -1) {
         perror("getrlimit");
@@ -112,7 +308,7 @@ int set_stack_size(void) {
 /*
  * Description:
  *   Creates a new lightweight process which executes the given function
- *   with the given argument.
+ *   with the given argument, using the default attributes.
  * Parameters:
  *   The function to execute in the new thread, along with its arguments.
  * Returns:
@@ -120,6 +316,23 @@ int set_stack_size(void) {
  *   or NO THREAD if the thread cannot be created.
  */
 tid_t lwp_create(lwpfun function, void *argument) {
+    return lwp_create_ex(function, argument, NULL);
+}
+
+/*
+ * Description:
+ *   Creates a new lightweight process which executes the given function
+ *   with the given argument. The attributes pick the stack size (0 for
+ *   the RLIMIT_STACK default), optionally supply the stack memory
+ *   itself, and give the scheduler an initial hint.
+ * Parameters:
+ *   The function to execute in the new thread, along with its arguments
+ *   and its attributes (NULL for the defaults).
+ * Returns:
+ *   The (lightweight) thread id of the new thread
+ *   or NO THREAD if the thread cannot be created.
+ */
+static tid_t create(lwpfun function, void *argument, const lwp_attr *attr) {
     if (check_init() == -1) {
         perror("initialization error");
         return NO_THREAD;
@@ -135,55 +348,270 @@ tid_t lwp_create(lwpfun function, void *argument) {
             return NO_THREAD;
         }
     }
+    if (attr != NULL && attr->stack != NULL && attr->stacksize < MIN_STACK) {
+        perror("caller-supplied stack is too small");
+        return NO_THREAD;
+    }
+    if (attr != NULL && attr->stack != NULL && (attr->flags & LWP_SHARED)) {
+        perror("a shared-stack thread cannot have its own stack");
+        return NO_THREAD;
+    }
+    if (attr != NULL && (attr->flags & LWP_SHARED)
+        && (attr->flags & LWP_XSTATE)) {
+        perror("a shared-stack thread cannot have its own xstate");
+        return NO_THREAD;
+    }
     /* check params */
 
-    thread new = malloc(sizeof(context));
-    if (new == NULL) {
-        perror("error mallocing new thread");
-        return NO_THREAD;
+    size_t size = stacksize;
+    if (attr != NULL && attr->stacksize != 0) {
+        size = attr->stacksize;
+        if (size < MIN_STACK) {
+            size = MIN_STACK;
+        }
+        if (attr->stack == NULL && size % pagesize != 0) {
+            size += pagesize - size % pagesize;
+        }
+    } else if (attr == NULL || !(attr->flags & LWP_SHARED)) {
+        size = stackprof_suggest(function, size);
+        if (size < MIN_STACK) {
+            size = MIN_STACK;
+        }
     }
+    /* our own stacks are whole pages; a caller's is used as given.
+       with autotuning on, the default is replaced by what this
+       function has been seen to need */
 
-    new->tid = ++threads;
+    thread new;
+    if (attr != NULL && (attr->flags & LWP_INSTACK)
+        && attr->stack == NULL && !(attr->flags & LWP_SHARED)) {
+        size_t span = (CTX_SPAN + pagesize - 1) & ~(pagesize - 1);
+        unsigned long *stack = stack_get(size + span);
+        if (stack == NULL) {
+            return NO_THREAD;
+        }
+        stackprof_prepare(stack, size + span);
+        new = (thread)((char *)stack + size + span - CTX_SPAN);
+        new->stack = stack;
+        new->stacksize = size + span;
+        new->flags = LWP_INSTACK;
+        size += span - CTX_SPAN;
+    } else {
+        new = ctx_alloc();
+        if (new == NULL) {
+            return NO_THREAD;
+        }
+        new->flags = 0;
+    }
+    /* the context comes from the slab, or sits at the very top of
+       the thread's own stack mapping with the frames right below it */
 
-    new->stack = mmap(NULL, stacksize,
-                      PROT_READ | PROT_WRITE,
-                      MAP_PRIVATE | MAP_ANONYMOUS,
-                      -1, 0);
-    if (new->stack == MAP_FAILED) {
-        perror("error mmaping new thread stack");
-        free(new);
+    new->tid = tid_alloc(new);
+    if (new->tid == NO_THREAD) {
+        if (new->flags & LWP_INSTACK) {
+            stack_put(new->stack, new->stacksize);
+        } else {
+            ctx_free(new);
+        }
         return NO_THREAD;
     }
-    /* create new thread var and new stack for it */
+    new->shared = NULL;
+    new->ssave = NULL;
+    new->ssavelen = 0;
+    new->ssavecap = 0;
+    new->ssavepeak = 0;
+    new->fun = function;
+    new->lib_q = NULL;
+    new->sched_q = NULL;
+    new->xarea = NULL;
+
+    if (new->flags & LWP_INSTACK) {
+        /* stack already in hand */
+    } else if (attr != NULL && (attr->flags & LWP_SHARED)) {
+        new->shared = shared_pick(size);
+        if (new->shared == NULL) {
+            tid_release(new->tid);
+            ctx_free(new);
+            return NO_THREAD;
+        }
+        new->stack = new->shared->base;
+        size = new->shared->size;
+        new->stacksize = size;
+        new->flags |= LWP_SHARED;
+    } else if (attr != NULL && attr->stack != NULL) {
+        new->stack = attr->stack;
+        new->stacksize = size;
+        new->flags |= LWP_USERSTACK;
+    } else {
+        new->stack = stack_get(size);
+        if (new->stack == NULL) {
+            tid_release(new->tid);
+            ctx_free(new);
+            return NO_THREAD;
+        }
+        new->stacksize = size;
+        stackprof_prepare(new->stack, size);
+    }
+    /* create new thread var and get a stack for it (reused if one
+       of the right size is cached, or a turn on a shared one) */
 
     unsigned long offset = ((unsigned long)(((char *)new->stack)
-                            + stacksize)) % BOUND;
-    *(unsigned long *)((char *)new->stack + stacksize - offset - BYTES * 2)
-        = (unsigned long)lwp_wrap;
+                            + size)) % BOUND;
+    unsigned long *ret = (unsigned long *)((char *)new->stack + size
+                                           - offset - BYTES);
     /*  going to the spot in bytes (with stacksize and offset).
-        then it divides by the size of a long, then -2 for correct
-        stack spot
+        the trampoline address sits one word under the aligned top so
+        that rsp is 16-byte aligned again once swap_cfiles returns to it
     */
+    if (new->flags & LWP_SHARED) {
+        if (shared_reserve(new, offset + BYTES) == -1) {
+            shared_release(new);
+            tid_release(new->tid);
+            ctx_free(new);
+            return NO_THREAD;
+        }
+        *(unsigned long *)new->ssave = (unsigned long)lwp_trampoline;
+        new->ssavelen = offset + BYTES;
+    } else {
+        *ret = (unsigned long)lwp_trampoline;
+    }
+    /* someone else may be on the shared stack right now, so a shared
+       thread's first frame starts out in its save buffer */
 
-    new->stacksize = stacksize;
-
-    new->state.rdi = (unsigned long)function;
-    new->state.rsi = (unsigned long)argument;
-    new->state.rbp = (unsigned long)((char *)new->stack +
-                      stacksize - offset - BYTES * 3);
-    /* set correct spot in stack for swap_rfiles to read properly */
-
-    new->state.fxsave = FPU_INIT;
+    new->cstate.rsp = (unsigned long)ret;
+    new->cstate.rbp = 0;
+    new->cstate.r12 = (unsigned long)function;
+    new->cstate.r13 = (unsigned long)argument;
+    new->cstate.r14 = (unsigned long)lwp_wrap;
+    new->cstate.mxcsr = MXCSR_INIT;
+    new->cstate.fcw = FCW_INIT;
+    /* set up the callee-saved frame so swap_cfiles "returns" into
+       lwp_trampoline, which calls lwp_wrap(function, argument) */
 
     new->status = LWP_LIVE;
+    new->hint = (attr != NULL) ? attr->hint : 0;
+    new->priority = (new->hint < LWP_PRIO_LEVELS) ? new->hint
+                                                  : LWP_PRIO_LEVELS - 1;
+    new->tickets = LWP_TICKETS;
+    new->sched_key = 0;
+    new->sched_slot = ~0UL;
+    new->sched_mark = 0;
+    new->runtime = 0;
+    new->deadline = 0;
+    new->missed = 0;
+    new->runstart = 0;
+    new->exited = NULL;
+    new->joiner = NULL;
+    new->timer.next = NULL;
+    new->wl = NULL;
+    if (attr != NULL && (attr->flags & LWP_DETACHED)) {
+        new->flags |= LWP_DETACHED;
+    }
 
     enqueue(all, new, TRUE);
+    if (attr != NULL && (attr->flags & LWP_XSTATE)) {
+        new->xarea = xstate_alloc();
+        if (new->xarea == NULL) {
+            reclaim(new);
+            return NO_THREAD;
+        }
+        new->flags |= LWP_XSTATE;
+    }
     sched->admit(new);
-    /* add to all and scheduler queue */
+    /* add to all and scheduler queue. an LWP_XSTATE thread starts
+       out with the initial register state */
 
     return new->tid;
 }
 
+/*
+ * Description:
+ *   lwp_create() with attributes; see create(). Not preemptible.
+ */
+tid_t lwp_create_ex(lwpfun function, void *argument, const lwp_attr *attr) {
+    int was = preempt_enter();
+    tid_t tid = create(function, argument, attr);
+    preempt_leave(was);
+    return tid;
+}
+
+/*
+ * Description:
+ *   Body of the copier context. Runs on its own small stack so it can
+ *   overwrite a shared stack that the thread switching away from is
+ *   still standing on.
+ * Parameters:
+ *   Unused (it is started the same way as a thread).
+ * Returns:
+ *   Never.
+ */
+static void copier_loop(lwpfun unused, void *arg) {
+    (void)unused;
+    (void)arg;
+    for (;;) {
+        thread to = copy_to;
+        shared_load(to);
+        swap_cfiles(&copier.cstate, &to->cstate);
+    }
+}
+
+/*
+ * Description:
+ *   Switches from one thread to another. When the target's frames are
+ *   not on its shared stack they are copied in first; if the current
+ *   thread is standing on that same stack, the copy is done from the
+ *   copier context instead.
+ * Parameters:
+ *   The thread switching out (the running one) and the one to run.
+ * Returns:
+ *   Once from is switched back to.
+ */
+static void lwp_switch(thread from, thread to) {
+    if (accounting) {
+        unsigned long now = lwp_now_ns();
+        from->runtime += now - from->runstart;
+        to->runstart = now;
+    }
+    running = to;
+    lwp_switches++;
+    if (to->shared != NULL && to->shared->owner != to) {
+        if (from->shared != to->shared) {
+            shared_load(to);
+        } else {
+            if (copier.stack == NULL) {
+                copier.stack = stack_get(COPIER_STACK);
+                if (copier.stack == NULL) {
+                    exit(1);
+                }
+                copier.cstate.rsp = (unsigned long)((char *)copier.stack
+                                    + COPIER_STACK - BYTES);
+                *(unsigned long *)copier.cstate.rsp
+                    = (unsigned long)lwp_trampoline;
+                copier.cstate.rbp = 0;
+                copier.cstate.r14 = (unsigned long)copier_loop;
+                copier.cstate.mxcsr = MXCSR_INIT;
+                copier.cstate.fcw = FCW_INIT;
+            }
+            /* first use: start it like a thread */
+            copy_to = to;
+            swap_cfiles(&(from -> cstate), &(copier.cstate));
+            bury();
+            return;
+        }
+    }
+    if (from->xarea != NULL || to->xarea != NULL) {
+        xstate_switch(from->xarea, to->xarea);
+    }
+    /* only LWP_XSTATE threads pay for their vector registers; the
+       copier path above never involves one */
+    swap_cfiles(&(from -> cstate), &(to -> cstate));
+    /* change state. a yield is a plain call, so the callee-saved
+       frame is all that has to survive it */
+    bury();
+    /* back on our own stack, so a detached thread that just exited
+       can go */
+}
+
 /*
  * Description:
  *   Starts the LWP system. Converts the calling thread into a LWP
@@ -193,30 +621,64 @@ tid_t lwp_create(lwpfun function, void *argument) {
  * Returns:
  *   Nothing.
  */
-void lwp_start(void) {
+static void start(void) {
     if (check_init() == -1) {
         perror("initialization error");
         return;
     }
 
-    thread new = malloc(sizeof(context));
+    thread new = ctx_alloc();
     if (new == NULL) {
-        perror("error mallocing new thread");
         return;
     }
     /* creates new context to save for current thread */
+    new->tid = tid_alloc(new);
+    if (new->tid == NO_THREAD) {
+        ctx_free(new);
+        return;
+    }
     running = new;
-    new->tid = ++threads;
     new->stack = NULL;
+    new->flags = 0;
+    new->hint = 0;
+    new->priority = 0;
+    new->tickets = LWP_TICKETS;
+    new->sched_key = 0;
+    new->sched_slot = ~0UL;
+    new->sched_mark = 0;
+    new->runtime = 0;
+    new->deadline = 0;
+    new->missed = 0;
+    new->runstart = lwp_now_ns();
+    new->exited = NULL;
+    new->joiner = NULL;
+    new->timer.next = NULL;
+    new->wl = NULL;
+    new->shared = NULL;
+    new->ssave = NULL;
+    new->fun = NULL;
+    new->xarea = NULL;
+    new->lib_q = NULL;
+    new->sched_q = NULL;
     new->status = LWP_LIVE;
 
     enqueue(all, new, TRUE);
     sched->admit(new);
     /* add main thread to all and scheduler */
-    lwp_yield();
+    yield();
     /* yield handles the rest */
 }
 
+/*
+ * Description:
+ *   Makes the caller an LWP; see start(). Not preemptible.
+ */
+void lwp_start(void) {
+    int was = preempt_enter();
+    start();
+    preempt_leave(was);
+}
+
 /*
  * Description:
  *   Yields control to another LWP. Which one depends on the scheduler.
@@ -228,7 +690,7 @@ void lwp_start(void) {
  * Returns:
  *   Nothing.
  */
-void lwp_yield(void) {
+static void yield(void) {
     if (check_init() == -1) {
         perror("initialization error");
         return;
@@ -237,21 +699,47 @@ void lwp_yield(void) {
     thread current = running;
     /* find current and reset running */
 
+    if (accounting) {
+        unsigned long now = lwp_now_ns();
+        current->runtime += now - current->runstart;
+        current->runstart = now;
+    }
+    /* bring its runtime up to date before the scheduler looks */
+
+    timer_poll();
+    io_poll();
+    /* wake any sleepers that are due so they get a look in */
+
     thread later = sched -> next();
 
-    if (later == NULL) {
-        exit(1);
+    while (later == NULL) {
+        if (io_idle() == -1) {
+            exit(1);
+        }
+        later = sched -> next();
+    }
+    /* only sleepers and I/O waiters left: idle until one can go. if
+       there are none, nothing will ever run again, so exit */
+    if (accounting) {
+        current->runstart = lwp_now_ns();
     }
-    /* if next val does not exist, exit */
+    /* time spent idle is nobody's */
 
     sched -> remove(later);
     sched -> admit(later);
     /* put it to the back of the queue */
 
-    running = later;
+    lwp_switch(current, later);
+}
 
-    swap_rfiles(&(current -> state), &(later -> state));
-    /* change state */
+/*
+ * Description:
+ *   Gives up the CPU; see yield(). Not preemptible.
+ */
+void lwp_yield(void) {
+    int was = preempt_enter();
+    yield();
+    preempt_leave(was);
 }
 
 /*
@@ -265,27 +753,250 @@ void lwp_yield(void) {
  *   Nothing.
  */
 void lwp_exit(int exitval) {
+    preempt_enter();
+    /* never left: whoever runs next restores its own state */
     if (check_init() == -1) {
         perror("initialization error");
         return;
     }
 
+    stackprof_record(running);
+    /* how deep did it go (only when profiling) */
     sched->remove(running);
     /* get current thread and remove from scheduler */
-    enqueue(zombie, running, FALSE);
     running->status = MKTERMSTAT(LWP_TERM, exitval);
-    /* set status and put into zombie list to be deallocted */
+    if (running->shared != NULL) {
+        running->shared->owner = NULL;
+    }
+    /* its frames are dead, nobody needs to save them */
 
-    if (blocked -> length > 0){
-        thread revived = blocked -> sen -> sched_one;
-        dequeue(blocked, revived, FALSE);
-        sched -> admit(revived);
-        /* put thread in waited list back into scheduler */
-        revived -> exited = running;
-        /* set exited of the waited thread to exited thread */
+    if (running->joiner != NULL) {
+        thread_unpark(running->joiner);
+        /* lwp_join() reaps it, lwp_wait() never sees it */
+    } else if (running->flags & LWP_DETACHED) {
+        dead = running;
+        /* reclaimed by bury() once we are off its stack */
+    } else {
+        enqueue(zombie, running, FALSE);
+        /* put into zombie list to be deallocted */
+        if (blocked -> length > 0){
+            thread revived = blocked -> sen -> sched_one;
+            dequeue(blocked, revived, FALSE);
+            thread_unpark(revived);
+            /* put thread in waited list back into scheduler */
+            revived -> exited = running;
+            /* set exited of the waited thread to exited thread */
+        }
     }
 
-    lwp_yield();
+    yield();
+}
+
+/*
+ * Description:
+ *   Switches straight to the given thread without consulting the
+ *   scheduler. Neither thread moves in the run queue, so the caller
+ *   keeps its place and gets its next turn as usual.
+ * Parameters:
+ *   The tid of the thread to run.
+ * Returns:
+ *   0 once the caller runs again (at once if it named itself), or -1
+ *   if the target does not exist or is not runnable.
+ */
+static int yield_to(tid_t tid) {
+    timer_poll();
+    thread target = tid2thread(tid);
+    if (target == NULL || LWPTERMINATED(target->status)
+        || (target->flags & LWP_PARKED)) {
+        return -1;
+    }
+    if (target == running) {
+        return 0;
+    }
+    lwp_switch(running, target);
+    return 0;
+}
+
+/*
+ * Description:
+ *   Directed yield; see yield_to(). Not preemptible.
+ */
+int lwp_yield_to(tid_t tid) {
+    int was = preempt_enter();
+    int rval = yield_to(tid);
+    preempt_leave(was);
+    return rval;
+}
+
+/*
+ * Description:
+ *   Takes a thread out of the scheduler because it is about to wait
+ *   for something. The caller is responsible for waking it.
+ * Parameters:
+ *   The thread (usually the running one).
+ * Returns:
+ *   Nothing.
+ */
+void thread_park(thread t) {
+    sched->remove(t);
+    t->flags |= LWP_PARKED;
+}
+
+/*
+ * Description:
+ *   Hands a parked thread back to the scheduler.
+ * Parameters:
+ *   The thread.
+ * Returns:
+ *   Nothing.
+ */
+void thread_unpark(thread t) {
+    t->flags &= ~LWP_PARKED;
+    sched->admit(t);
+}
+
+/*
+ * Description:
+ *   Tells whether anything could still wake a thread that has just
+ *   parked itself: another runnable thread, an armed timer, or a
+ *   descriptor someone is waiting on.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   TRUE or FALSE.
+ */
+int wake_possible(void) {
+    return sched->qlen() > 0 || timer_armed() > 0 || io_waiting() > 0;
+}
+
+/*
+ * Description:
+ *   Sets a thread's priority (0 is the most urgent). A runnable thread
+ *   is taken out of the scheduler and admitted again so a priority
+ *   scheduler files it under the new level.
+ * Parameters:
+ *   The tid and the priority, below LWP_PRIO_LEVELS.
+ * Returns:
+ *   0 on success, -1 if the thread or priority is invalid.
+ */
+static int set_priority(tid_t tid, unsigned int prio) {
+    thread t = tid2thread(tid);
+    if (t == NULL || prio >= LWP_PRIO_LEVELS) {
+        return -1;
+    }
+    if (t->priority == prio) {
+        return 0;
+    }
+    if (LWPTERMINATED(t->status) || (t->flags & LWP_PARKED)) {
+        t->priority = prio;
+        return 0;
+    }
+    sched->remove(t);
+    t->priority = prio;
+    sched->admit(t);
+    return 0;
+}
+
+/*
+ * Description:
+ *   Sets a thread's priority; see set_priority(). Not preemptible.
+ */
+int lwp_set_priority(tid_t tid, unsigned int prio) {
+    int was = preempt_enter();
+    int rval = set_priority(tid, prio);
+    preempt_leave(was);
+    return rval;
+}
+
+/*
+ * Description:
+ *   Turns run-time accounting on or off. While it is on, every switch
+ *   reads the clock and adds the time the outgoing thread ran to its
+ *   runtime. Schedulers that need it (Fair) turn it on themselves.
+ * Parameters:
+ *   TRUE or FALSE.
+ * Returns:
+ *   Whether it was on before.
+ */
+int lwp_account(int on) {
+    int was = accounting;
+    if (on && !was && running != NULL) {
+        running->runstart = lwp_now_ns();
+    }
+    accounting = on;
+    return was;
+}
+
+/*
+ * Description:
+ *   Reports how long a thread has run, as far as accounting has seen.
+ * Parameters:
+ *   The tid.
+ * Returns:
+ *   Nanoseconds on the CPU, or 0 for an unknown tid.
+ */
+unsigned long lwp_cputime(tid_t tid) {
+    thread t = tid2thread(tid);
+    if (t == NULL) {
+        return 0;
+    }
+    if (accounting && t == running) {
+        return t->runtime + (lwp_now_ns() - t->runstart);
+    }
+    return t->runtime;
+}
+
+/*
+ * Description:
+ *   Frees an exited thread's stack and context and retires its tid.
+ *   It must already be off the zombie list.
+ * Parameters:
+ *   The thread.
+ * Returns:
+ *   0 on success, -1 if its stack could not be given back.
+ */
+static int reclaim(thread delete) {
+    dequeue(all, delete, TRUE);
+    tid_release(delete->tid);
+    xstate_free(delete->xarea);
+
+    if (delete -> flags & LWP_SHARED) {
+        shared_release(delete);
+    } else if (delete -> flags & LWP_INSTACK) {
+        stack_put(delete->stack, delete->stacksize);
+        return 0;
+        /* the context went with its stack */
+    } else if (delete -> stack != NULL
+               && !(delete -> flags & LWP_USERSTACK)){
+        if (stack_put(delete->stack, delete->stacksize) == -1) {
+            ctx_free(delete);
+            return -1;
+        };
+    }
+    /* if main thread stack or the caller's memory, do not deallocate.
+       others go back to the stack cache */
+
+    ctx_free(delete);
+    return 0;
+    /* unqueue it and free it all */
+}
+
+/*
+ * Description:
+ *   Reclaims the detached thread that exited last, if any. Called by
+ *   whichever thread runs after it, since the exiting thread cannot
+ *   free the stack it is standing on.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+static void bury(void) {
+    if (dead != NULL) {
+        thread t = dead;
+        dead = NULL;
+        reclaim(t);
+    }
 }
 
 /*
@@ -297,22 +1008,25 @@ void lwp_exit(int exitval) {
  * Returns:
  *   The tid of the terminated thread or NO_THREAD.
  */
-tid_t lwp_wait(int *status) {
+static tid_t reap(int *status) {
     if (check_init() == -1) {
         perror("initialization error");
         return NO_THREAD;
     }
 
-    if (zombie -> length < 1){
-        sched -> remove(running);
+    while (zombie -> length < 1){
+        thread_park(running);
         enqueue(blocked, running, FALSE);
-        if (sched -> qlen() < 1){
+        if (!wake_possible()){
+            dequeue(blocked, running, FALSE);
+            thread_unpark(running);
             return NO_THREAD;
         }
-        /* if there are no more threads, just ret */
-        lwp_yield();
+        /* if there are no more threads, put it back and just ret */
+        yield();
     }
-    /* wait for zombie to show up */
+    /* wait for zombie to show up. lwp_join or lwp_detach can take the
+       one that woke us before we run, so check again */
 
     thread delete = zombie -> sen -> sched_one;
     if (status != NULL){
@@ -321,19 +1035,108 @@ tid_t lwp_wait(int *status) {
     tid_t final = delete -> tid;
     /* find the oldest to delete and get the id */
     dequeue(zombie, delete, FALSE);
-    dequeue(all, delete, TRUE);
+    return (reclaim(delete) == -1) ? NO_THREAD : final;
+}
+
+/*
+ * Description:
+ *   Waits for and reaps a thread; see reap(). Not preemptible.
+ */
+tid_t lwp_wait(int *status) {
+    int was = preempt_enter();
+    tid_t tid = reap(status);
+    preempt_leave(was);
+    return tid;
+}
+
+/*
+ * Description:
+ *   Waits for one particular thread to terminate, then deallocates
+ *   its resources and reports its termination status if status is
+ *   non-NULL. The caller is parked in the thread's joiner slot, so
+ *   only that thread's exit wakes it, and lwp_wait() will not reap
+ *   the thread first.
+ * Parameters:
+ *   The tid to wait for and a pointer to an int that will hold its
+ *   termination status.
+ * Returns:
+ *   The tid, or NO_THREAD if there is no such thread, it is detached
+ *   or already being joined, it is the caller, or nothing else could
+ *   ever run to end it.
+ */
+static tid_t join(tid_t tid, int *status) {
+    if (check_init() == -1) {
+        perror("initialization error");
+        return NO_THREAD;
+    }
+
+    thread t = tid2thread(tid);
+    if (t == NULL || t == running || t->joiner != NULL
+        || (t->flags & LWP_DETACHED)) {
+        return NO_THREAD;
+    }
 
-    if (delete -> stack != NULL){
-        if (munmap(delete->stack, delete->stacksize) == -1) {
-            perror("error munmap");
+    if (LWPTERMINATED(t->status)) {
+        dequeue(zombie, t, FALSE);
+        /* already exited: take it off the zombie list */
+    } else {
+        t->joiner = running;
+        thread_park(running);
+        if (!wake_possible()) {
+            thread_unpark(running);
+            t->joiner = NULL;
             return NO_THREAD;
-        };
+        }
+        yield();
+        /* lwp_exit() unparks us and leaves t off the zombie list */
     }
-    /* if main thread stack, do not deallocate */
 
-    free(delete);
-    return final;
-    /* unqueue it and free it all */
+    if (status != NULL) {
+        *status = t->status;
+    }
+    return (reclaim(t) == -1) ? NO_THREAD : tid;
+}
+
+/*
+ * Description:
+ *   Waits for and reaps a given thread; see join(). Not preemptible.
+ */
+tid_t lwp_join(tid_t tid, int *status) {
+    int was = preempt_enter();
+    tid = join(tid, status);
+    preempt_leave(was);
+    return tid;
+}
+
+/*
+ * Description:
+ *   Detaches a thread: when it exits, its stack and context are
+ *   reclaimed at the next switch and nobody waits for it. One that
+ *   has already exited is reclaimed now.
+ * Parameters:
+ *   The tid.
+ * Returns:
+ *   0 on success, -1 if there is no such thread or it is already
+ *   being joined.
+ */
+int lwp_detach(tid_t tid) {
+    if (check_init() == -1) {
+        perror("initialization error");
+        return -1;
+    }
+    int was = preempt_enter();
+    thread t = tid2thread(tid);
+    if (t == NULL || t->joiner != NULL) {
+        preempt_leave(was);
+        return -1;
+    }
+    t->flags |= LWP_DETACHED;
+    if (LWPTERMINATED(t->status) && t != dead) {
+        dequeue(zombie, t, FALSE);
+        reclaim(t);
+    }
+    preempt_leave(was);
+    return 0;
 }
 
 /*
@@ -365,37 +1168,28 @@ thread tid2thread(tid_t tid) {
         return NULL;
     }
 
-    int test = FALSE;
-
-    thread current = all -> sen -> lib_one;
-    while (test == FALSE){
-        if (current == (all -> sen)){
-            current = NULL;
-            test = TRUE;
-        }
-        else if ((current -> tid) == tid){
-            test = TRUE;
-        } else {
-            current = current -> lib_one;
-        }
+    unsigned int slot = tid & TID_SLOTMASK;
+    if (slot == 0 || slot >= tidused
+        || tids[slot].gen != (tid >> TID_GENSHIFT)) {
+        return NULL;
     }
-    /* iterates through all till is done or finds */
-
-    return current;
+    return tids[slot].t;
+    /* a reaped thread's slot is NULL, or reused with a newer gen */
 }
 
 /*
  * Description:
  *   Causes the LWP package to use the given scheduler to choose
  *   the next process to run. Transfers all threads from the old
- *   scheduler to the new one in next() order. If scheduler is NULL
- *   the library returns to round-robin scheduling.
+ *   scheduler to the new one, through drain() and admit_batch() when
+ *   they have them and in next() order otherwise. If scheduler is
+ *   NULL the library returns to round-robin scheduling.
  * Parameters:
  *   A new scheduler to choose which LWP to run.
  * Returns:
  *   Nothing.
  */
-void lwp_set_scheduler(scheduler new) {
+static void migrate(scheduler new) {
     if (check_init() == -1) {
         perror("initialization error");
         return;
@@ -416,6 +1210,8 @@ void lwp_set_scheduler(scheduler new) {
         mid->remove = rr_remove;
         mid->next = rr_next;
         mid->qlen = rr_qlen;
+        mid->drain = rr_drain;
+        mid->admit_batch = rr_admit_batch;
     } else {
         mid->init = new->init;
         mid->shutdown = new->shutdown;
@@ -423,6 +1219,8 @@ void lwp_set_scheduler(scheduler new) {
         mid->remove = new->remove;
         mid->next = new->next;
         mid->qlen = new->qlen;
+        mid->drain = new->drain;
+        mid->admit_batch = new->admit_batch;
     }
     if (mid->init != NULL) {
         mid->init();
@@ -431,19 +1229,33 @@ void lwp_set_scheduler(scheduler new) {
     Queue *temp = startup(FALSE);
     if (temp == NULL) {
         perror("cannot allocate temp context");
+        if (mid->shutdown != NULL) {
+            mid->shutdown();
+        }
+        free(mid);
         return;
     }
 
-    while (sched->qlen() > 0) {
-        thread cur = sched->next();
-        sched->remove(cur);
-        enqueue(temp, cur, FALSE);
+    if (sched->drain != NULL) {
+        sched->drain(temp);
+    } else {
+        while (sched->qlen() > 0) {
+            thread cur = sched->next();
+            sched->remove(cur);
+            enqueue(temp, cur, FALSE);
+        }
     }
-    while (temp->length > 0) {
-        thread cur = temp->sen->sched_one;
-        dequeue(temp, cur, FALSE);
-        mid->admit(cur);
+    if (mid->admit_batch != NULL) {
+        mid->admit_batch(temp);
+    } else {
+        while (temp->length > 0) {
+            thread cur = temp->sen->sched_one;
+            dequeue(temp, cur, FALSE);
+            mid->admit(cur);
+        }
     }
+    shutdown(temp);
+    /* in bulk where the policies allow it, else one thread at a time */
 
     if (sched->shutdown != NULL) {
         sched->shutdown();
@@ -452,6 +1264,16 @@ void lwp_set_scheduler(scheduler new) {
     sched = mid;
 }
 
+/*
+ * Description:
+ *   Changes the scheduler; see migrate(). Not preemptible.
+ */
+void lwp_set_scheduler(scheduler new) {
+    int was = preempt_enter();
+    migrate(new);
+    preempt_leave(was);
+}
+
 /*
  * Description:
  *   Retrieves the current scheduler.
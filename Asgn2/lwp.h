@@ -1,6 +1,8 @@
 #ifndef LWPH
 #define LWPH
 #include <sys/types.h>
+#include <signal.h>
+#include <unistd.h>
 
 #ifndef TRUE
 #define TRUE 1
@@ -32,29 +34,209 @@ registers {
   unsigned long r15;
   struct fxsave fxsave;   /* space to save floating point state */
 } rfile;
+
+/* Compact frame for voluntary switches.  A yield is an ordinary call, so
+ * only the System V callee-saved registers and the FP control words have
+ * to survive it.  Fits in one cache line.
+ */
+typedef struct __attribute__ ((aligned(16))) __attribute__ ((packed))
+cregisters {
+  unsigned long rbx;            /* callee-saved general registers */
+  unsigned long rbp;
+  unsigned long rsp;
+  unsigned long r12;
+  unsigned long r13;
+  unsigned long r14;
+  unsigned long r15;
+  unsigned int  mxcsr;          /* SSE control/status             */
+  unsigned short fcw;           /* x87 control word               */
+  unsigned short pad;
+} cfile;
 #else
   #error "This only works on x86_64 for now"
 #endif
 
+/* A tid is a slot in the library's thread table (low 32 bits) plus
+ * the slot's generation (high bits), so the first tids are 1, 2, 3...
+ * and a reaped thread's tid never finds the slot's next occupant.
+ */
 typedef unsigned long tid_t;
 #define NO_THREAD 0             /* an always invalid thread id */
 
 typedef struct threadinfo_st *thread;
+
+/* A timer on the library's timing wheel; see timer.c.  Zero-filled
+ * means disarmed.
+ */
+#define LWP_TIMER_LEVELS 6      /* of 64 slots, 65.5us ticks at the bottom */
+typedef struct lwp_timer {
+  struct lwp_timer *next;       /* in its slot, NULL when disarmed */
+  struct lwp_timer *prev;
+  unsigned long expires;        /* CLOCK_MONOTONIC ns              */
+  void          (*fire)(struct lwp_timer *);
+  void          *arg;
+  int           slot;           /* level * 64 + slot               */
+} lwp_timer;
+
+/* An execution stack that LWP_SHARED threads take turns on.  Only the
+ * owner's frames are on it; the others' are saved in their contexts.
+ */
+typedef struct sharedstack {
+  unsigned long *base;          /* as from stack_get()      */
+  size_t        size;
+  thread        owner;          /* whose frames are on it   */
+} sharedstack;
 typedef struct threadinfo_st {
   tid_t         tid;            /* lightweight process id  */
   unsigned long *stack;         /* Base of allocated stack */
   size_t        stacksize;      /* Size of allocated stack */
-  rfile         state;          /* saved registers         */
+  rfile         state;          /* for swap_rfiles callers; the
+                                   library never fills it  */
   unsigned int  status;         /* exited? exit status?    */
   thread        lib_one;        /* Two pointers reserved   */
   thread        lib_two;        /* for use by the library  */
   thread        sched_one;      /* Two more for            */
   thread        sched_two;      /* schedulers to use       */
+  unsigned long sched_slot;     /* and an index for them   */
+  unsigned long sched_key;      /* and a sort key          */
+  unsigned long sched_mark;     /* and a bookmark          */
   thread        exited;         /* and one for lwp_wait()  */
+  thread        joiner;         /* and one for lwp_join()  */
+  lwp_timer     timer;          /* for sleeps and timed waits   */
+  struct lwp_waitlist *wl;      /* the one it is waiting on     */
+  cfile         cstate;         /* regs saved by lwp_yield */
+  unsigned int  flags;          /* LWP_* bits below        */
+  unsigned long hint;           /* lwp_attr hint for scheds */
+  unsigned int  priority;       /* 0 (first) .. LWP_PRIO_LEVELS-1 */
+  unsigned int  tickets;        /* share under Stride           */
+  unsigned long runtime;        /* ns run, see lwp_account()    */
+  unsigned long runstart;       /* when it last got the CPU     */
+  unsigned long deadline;       /* CLOCK_MONOTONIC ns, 0 = none */
+  unsigned long missed;         /* deadlines it has run past    */
+  sharedstack   *shared;        /* LWP_SHARED: stack it runs on */
+  void          *ssave;         /* and its frames when off it   */
+  size_t        ssavelen;
+  size_t        ssavecap;
+  size_t        ssavepeak;      /* most ever saved, for profiling */
+  int           (*fun)(void *); /* entry function              */
+  struct Queue  *lib_q;         /* queue lib_one/two link into  */
+  struct Queue  *sched_q;       /* and sched_one/two, or NULL   */
+  void          *xarea;         /* LWP_XSTATE: its saved state  */
 } context;
 
+/* contexts are handed out in 64-byte (cache line) aligned slots */
+#define CTX_SPAN ((sizeof(context) + 63) & ~(size_t)63)
+
+/* context flags (LWP_SHARED, LWP_INSTACK, LWP_DETACHED and LWP_XSTATE
+ * may also be given in lwp_attr.flags)
+ */
+#define LWP_USERSTACK 0x1       /* stack belongs to the caller */
+#define LWP_SHARED    0x2       /* runs on a shared stack      */
+#define LWP_INSTACK   0x4       /* context lives at the top of
+                                   its own stack mapping       */
+#define LWP_PARKED    0x8       /* waiting, not in the scheduler */
+#define LWP_LATE      0x10      /* current deadline already missed */
+#define LWP_DETACHED  0x20      /* reclaimed on exit, never waited */
+#define LWP_EXPIRED   0x40      /* its timed wait timed out      */
+#define LWP_XSTATE    0x80      /* has its own extended state    */
+
+#define LWP_PRIO_LEVELS 64      /* see lwp_set_priority() */
+#define LWP_TICKETS     100     /* default for lwp_set_tickets() */
+
+/* Attributes for lwp_create_ex().  Zero-filled means the defaults. */
+typedef struct lwp_attr {
+  size_t        stacksize;      /* bytes of stack; 0 for RLIMIT_STACK */
+  void          *stack;         /* caller-owned stack memory, or NULL */
+  unsigned long hint;           /* copied to thread->hint for the
+                                   scheduler's admit() to use, and the
+                                   initial priority (capped)           */
+  unsigned int  flags;          /* LWP_SHARED: no stack of its own;
+                                   frames are copied on and off one of
+                                   the shared stacks at switch time.
+                                   Its stack addresses must not be
+                                   handed to other threads.
+                                   LWP_INSTACK: put the context at the
+                                   top of the stack mapping instead of
+                                   in the slab (library stacks only).
+                                   LWP_DETACHED: see lwp_detach().
+                                   LWP_XSTATE: its vector registers
+                                   (SSE, AVX, AVX-512) are its own.
+                                   Other threads do not see what it
+                                   leaves in them, and they hold what
+                                   it left when it switches back in.
+                                   Costs an XSAVE and XRSTOR each way,
+                                   and not with LWP_SHARED.            */
+} lwp_attr;
+
 typedef int (*lwpfun)(void *);  /* type for lwp function */
 
+/* FIFO of parked threads, linked through sched_one (next) and
+ * sched_two (prev), which are free while a thread is out of the
+ * scheduler.  See sync.c.
+ */
+typedef struct lwp_waitlist {
+  thread        head;
+  thread        tail;
+} lwp_waitlist;
+
+typedef struct lwp_mutex {
+  thread        owner;          /* or NULL when unlocked */
+  lwp_waitlist  waiters;
+} lwp_mutex;
+
+typedef struct lwp_cond {
+  lwp_mutex     *mutex;         /* the one its waiters use */
+  lwp_waitlist  waiters;
+} lwp_cond;
+
+typedef struct lwp_sem {
+  unsigned long count;
+  lwp_waitlist  waiters;
+} lwp_sem;
+
+/* Channel of elemsize-byte elements; see chan.c */
+typedef struct lwp_chan {
+  size_t        elemsize;
+  size_t        cap;            /* 0 (unbuffered), a bound, or
+                                   LWP_CHAN_UNBOUNDED           */
+  size_t        len;            /* elements buffered            */
+  size_t        first;          /* slot of the oldest           */
+  size_t        slots;          /* allocated in buf             */
+  char          *buf;
+  int           closed;
+  struct chan_node *sendq;      /* blocked senders, FIFO        */
+  struct chan_node *recvq;      /* and receivers                */
+} lwp_chan;
+
+/* One case of lwp_chan_select() */
+typedef struct lwp_chancase {
+  lwp_chan      *chan;
+  int           send;           /* TRUE to send, FALSE to receive */
+  void          *data;          /* element to send or receive into */
+  int           result;         /* set when it fires: 0 or
+                                   LWP_CHAN_CLOSED              */
+} lwp_chancase;
+
+#define LWP_CHAN_UNBOUNDED ((size_t)-1)
+#define LWP_CHAN_CLOSED    (-2)
+#define LWP_CHAN(type, cap) lwp_chan_new(sizeof(type), (cap))
+
+#define LWP_TIMEDOUT       (-3)     /* from the timed waits */
+
+#define LWP_MUTEX_INITIALIZER { NULL, { NULL, NULL } }
+#define LWP_COND_INITIALIZER  { NULL, { NULL, NULL } }
+
+/* Peak stack use of one entry function, from lwp_stack_stats().
+ * Percentiles are over its last LWP_PROF_SAMPLES exits.
+ */
+#define LWP_PROF_SAMPLES 256
+typedef struct lwp_stackstat {
+  unsigned long count;          /* exits recorded      */
+  size_t        max;            /* deepest ever, bytes */
+  size_t        p50;
+  size_t        p99;
+} lwp_stackstat;
+
 /* Tuple that describes a scheduler */
 typedef struct scheduler {
   void   (*init)(void);            /* initialize any structures     */
@@ -63,18 +245,95 @@ typedef struct scheduler {
   void   (*remove)(thread victim); /* remove a thread from the pool */
   thread (*next)(void);            /* select a thread to schedule   */
   int    (*qlen)(void);            /* number of ready threads       */
+  /* optional, for lwp_set_scheduler(); NULL means thread by thread */
+  void   (*drain)(struct Queue *out);      /* move all threads to out */
+  void   (*admit_batch)(struct Queue *in); /* add all threads on in   */
 } *scheduler;
 
 /* lwp functions */
 extern tid_t lwp_create(lwpfun,void *);
+extern tid_t lwp_create_ex(lwpfun,void *,const lwp_attr *);
 extern void  lwp_exit(int status);
 extern tid_t lwp_gettid(void);
 extern void  lwp_yield(void);
+extern int   lwp_yield_to(tid_t tid);
 extern void  lwp_start(void);
 extern tid_t lwp_wait(int *);
+extern tid_t lwp_join(tid_t tid, int *status);
+extern int   lwp_detach(tid_t tid);
 extern void  lwp_set_scheduler(scheduler fun);
 extern scheduler lwp_get_scheduler(void);
 extern thread tid2thread(tid_t tid);
+extern int   lwp_set_priority(tid_t tid, unsigned int prio);
+extern int   lwp_account(int on);
+extern unsigned long lwp_cputime(tid_t tid);
+extern unsigned long lwp_now_ns(void);
+
+/* opt-in preemption (see preempt.c).  With a quantum set, the timer
+ * signal's handler calls lwp_yield() itself (the handler runs with
+ * SA_NODEFER), so the running LWP can be switched out at any
+ * instruction outside the library, and other LWPs run before its
+ * handler returns.  Anything that is not async-signal-safe (malloc,
+ * free, stdio, most of libc) must therefore be called between
+ * lwp_preempt_disable() and lwp_preempt_enable(): an LWP preempted
+ * inside malloc still holds malloc's lock, and the next LWP to call
+ * it deadlocks the process.  The sections nest; a tick that lands in
+ * one is taken when the outermost lwp_preempt_enable() is reached.
+ */
+extern int   lwp_preempt(unsigned long quantum_us);
+extern void  lwp_preempt_disable(void);
+extern void  lwp_preempt_enable(void);
+
+/* timers and sleeping (see timer.c) */
+extern void  lwp_timer_init(lwp_timer *t);
+extern void  lwp_timer_arm(lwp_timer *t, unsigned long abs_ns,
+                           void (*fire)(lwp_timer *), void *arg);
+extern int   lwp_timer_cancel(lwp_timer *t);
+extern int   lwp_sleep_ns(unsigned long ns);
+extern int   lwp_sleep_until(unsigned long abs_ns);
+
+/* blocking-style I/O that parks only the calling LWP (see io.c).
+ * <sys/socket.h> is not included here, since its shutdown() would
+ * clash with the queue's.
+ */
+struct sockaddr;
+extern ssize_t lwp_read(int fd, void *buf, size_t count);
+extern ssize_t lwp_write(int fd, const void *buf, size_t count);
+extern int   lwp_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+extern int   lwp_connect(int fd, const struct sockaddr *addr,
+                         socklen_t addrlen);
+extern int   lwp_poll_fd(int fd, short events, unsigned long abs_ns);
+extern int   lwp_close(int fd);
+
+/* synchronization (see sync.c) */
+extern void  lwp_mutex_init(lwp_mutex *m);
+extern int   lwp_mutex_lock(lwp_mutex *m);
+extern int   lwp_mutex_trylock(lwp_mutex *m);
+extern int   lwp_mutex_timedlock(lwp_mutex *m, unsigned long abs_ns);
+extern int   lwp_mutex_unlock(lwp_mutex *m);
+extern void  lwp_cond_init(lwp_cond *c);
+extern int   lwp_cond_wait(lwp_cond *c, lwp_mutex *m);
+extern int   lwp_cond_timedwait(lwp_cond *c, lwp_mutex *m,
+                                unsigned long abs_ns);
+extern void  lwp_cond_signal(lwp_cond *c);
+extern void  lwp_cond_broadcast(lwp_cond *c);
+extern void  lwp_sem_init(lwp_sem *s, unsigned long count);
+extern int   lwp_sem_wait(lwp_sem *s);
+extern int   lwp_sem_trywait(lwp_sem *s);
+extern int   lwp_sem_timedwait(lwp_sem *s, unsigned long abs_ns);
+extern void  lwp_sem_post(lwp_sem *s);
+
+/* channels (see chan.c) */
+extern lwp_chan *lwp_chan_new(size_t elemsize, size_t cap);
+extern int   lwp_chan_free(lwp_chan *ch);
+extern int   lwp_chan_send(lwp_chan *ch, const void *elem);
+extern int   lwp_chan_recv(lwp_chan *ch, void *elem);
+extern int   lwp_chan_try_send(lwp_chan *ch, const void *elem);
+extern int   lwp_chan_try_recv(lwp_chan *ch, void *elem);
+extern int   lwp_chan_close(lwp_chan *ch);
+extern int   lwp_chan_select(lwp_chancase *cases, int n, int wait);
+extern void  thread_park(thread t);
+extern void  thread_unpark(thread t);
 
 /* scheduler functions */
 extern void rr_init(void);
@@ -84,6 +343,121 @@ extern void rr_admit(thread new);
 extern void rr_remove(thread victim);
 extern thread rr_next(void);
 extern int rr_qlen(void);
+extern void rr_drain(struct Queue *out);
+extern void rr_admit_batch(struct Queue *in);
+
+/* ring scheduler functions (RingRobin in schedulers.h) */
+extern void ring_init(void);
+extern void ring_shutdown(void);
+extern void ring_admit(thread new);
+extern void ring_remove(thread victim);
+extern thread ring_next(void);
+extern int ring_qlen(void);
+extern void ring_drain(struct Queue *out);
+extern void ring_admit_batch(struct Queue *in);
+
+/* priority scheduler functions (Priority in schedulers.h) */
+extern void prio_init(void);
+extern void prio_shutdown(void);
+extern void prio_admit(thread new);
+extern void prio_push(thread new);
+extern void prio_remove(thread victim);
+extern thread prio_next(void);
+extern int prio_qlen(void);
+extern void prio_drain(struct Queue *out);
+
+/* stride scheduler functions (Stride in schedulers.h) */
+extern void stride_init(void);
+extern void stride_shutdown(void);
+extern void stride_admit(thread new);
+extern void stride_remove(thread victim);
+extern thread stride_next(void);
+extern int stride_qlen(void);
+extern void stride_drain(struct Queue *out);
+extern int lwp_set_tickets(tid_t tid, unsigned int tickets);
+
+/* fair scheduler functions (Fair in schedulers.h) */
+extern void fair_init(void);
+extern void fair_shutdown(void);
+extern void fair_admit(thread new);
+extern void fair_remove(thread victim);
+extern thread fair_next(void);
+extern int fair_qlen(void);
+extern void fair_drain(struct Queue *out);
+extern void fair_admit_batch(struct Queue *in);
+
+/* EDF scheduler functions (EarliestDeadline in schedulers.h) */
+extern void edf_init(void);
+extern void edf_shutdown(void);
+extern void edf_admit(thread new);
+extern void edf_remove(thread victim);
+extern thread edf_next(void);
+extern int edf_qlen(void);
+extern void edf_drain(struct Queue *out);
+extern int lwp_set_deadline(tid_t tid, unsigned long abs_ns);
+extern unsigned long lwp_deadline_misses(tid_t tid);
+
+/* preemption (see preempt.c) */
+#define LWP_PREEMPT_SIG SIGVTALRM
+extern volatile sig_atomic_t lwp_critical;
+extern unsigned long lwp_switches;
+extern int preempt_enter(void);
+extern void preempt_leave(int was);
+
+/* the timing wheel's and the reactor's hooks into lwp_yield() (see
+ * timer.c and io.c)
+ */
+extern void timer_poll(void);
+extern int timer_idle(void);
+extern long timer_armed(void);
+extern long timer_wait_ns(void);
+extern void io_poll(void);
+extern int io_idle(void);
+extern long io_waiting(void);
+extern int wake_possible(void);
+
+/* wait lists (see sync.c) */
+extern void wait_append(lwp_waitlist *w, thread t);
+extern void wait_remove(lwp_waitlist *w, thread t);
+extern thread wait_pop(lwp_waitlist *w);
+extern int wait_on(lwp_waitlist *w);
+extern int wait_until(lwp_waitlist *w, unsigned long abs_ns);
+extern thread wake_one(lwp_waitlist *w);
+
+/* extended state functions (see xstate.c) */
+#define XMODE_NONE     0        /* no XSAVE; areas are fxsave images */
+#define XMODE_XSAVE    1
+#define XMODE_XSAVEOPT 2        /* skips components unmodified since xrstor */
+#define XMODE_XSAVEC   3        /* compacted, skips init components */
+extern unsigned long lwp_xmask;
+extern unsigned long lwp_xsize;
+extern int lwp_xmode;
+extern int xstate_probe(void);
+extern void *xstate_alloc(void);
+extern void xstate_free(void *area);
+extern void xstate_switch(void *from, void *to);
+
+/* stack cache functions */
+extern unsigned long *stack_get(size_t size);
+extern int stack_put(unsigned long *stack, size_t size);
+extern int stack_in_guard(unsigned long *stack, void *addr);
+extern int lwp_shared_stacks(int count, size_t size);
+extern sharedstack *shared_pick(size_t size);
+extern void shared_release(thread t);
+extern int shared_reserve(thread t, size_t len);
+extern void shared_load(thread t);
+extern void lwp_stack_cache(int cap, size_t budget);
+
+/* stack profiling functions */
+extern void lwp_stack_profile(int enable, int autotune);
+extern int lwp_stack_stats(lwpfun fun, lwp_stackstat *out);
+extern void stackprof_prepare(unsigned long *stack, size_t size);
+extern void stackprof_record(thread t);
+extern size_t stackprof_suggest(lwpfun fun, size_t size);
+
+/* context allocator functions */
+extern thread ctx_alloc(void);
+extern void ctx_free(thread t);
 
 /* queue struct */
 typedef struct Queue {
@@ -91,13 +465,34 @@ typedef struct Queue {
   int length;
 } Queue;
 
+/* min-heap of threads by sched_key, index in sched_slot */
+typedef struct Heap {
+  thread *items;
+  int length;
+  int cap;
+} Heap;
+
+/* heap functions */
+extern Heap *heap_new(void);
+extern void heap_free(Heap *h);
+extern int heap_push(Heap *h, thread t);
+extern void heap_remove(Heap *h, thread t);
+extern void heap_fix(Heap *h, thread t);
+extern thread heap_peek(Heap *h);
+extern int inheap(Heap *h, thread t);
+extern void heap_drain(Heap *h, struct Queue *out);
+
 /* queue functions */
 extern Queue *startup(int lib);
 extern void shutdown(Queue *q);
 extern void enqueue(Queue *q, thread t, int lib);
+extern void push(Queue *q, thread t, int lib);
 extern void dequeue(Queue *q, thread t, int lib);
+extern int inqueue(Queue *q, thread t, int lib);
+extern void splice(Queue *to, Queue *from);
 
 extern scheduler sched;
+extern thread running;
 
 /* for lwp_wait */
 #define TERMOFFSET        8
@@ -109,5 +504,9 @@ extern scheduler sched;
 
 /* prototypes for asm functions */
 void swap_rfiles(rfile *old, rfile *new);
+void swap_cfiles(cfile *old, cfile *new);
+void lwp_trampoline(void);
+void xstate_save(void *area, unsigned long mask);
+void xstate_load(void *area, unsigned long mask);
 
 #endif
@@ -0,0 +1,547 @@
+/*
+ * Description: Microbenchmarks for context switching, thread lifecycle,
+ *              tid lookup and scheduler migration. Reports ns/op with
+ *              percentiles, as a table or (-j) as JSON.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include "schedulers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_SAMPLES 50
+#define MIN_SAMPLES 5
+#define SAMPLE_NS 20000           /* aim for >= 20us per sample     */
+#define POINT_NS 1000000000L      /* stop sampling a point after 1s */
+#define DEFAULT_MAX 10000
+
+typedef struct result {
+    const char *name;
+    long threads;
+    long iters;                   /* ops per sample */
+    int nsamples;
+    double ns[MAX_SAMPLES];       /* ns/op of each sample */
+} result;
+
+static volatile int stop = FALSE;
+static int json = FALSE;
+static int printed = 0;
+
+/*
+ * Description:
+ *   LWP body that yields until told to stop.
+ * Parameters:
+ *   Unused.
+ * Returns:
+ *   0.
+ */
+static int spinner(void *arg) {
+    (void)arg;
+    while (!stop) {
+        lwp_yield();
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ *   LWP body that hands the CPU straight back to a partner until told
+ *   to stop.
+ * Parameters:
+ *   A pointer to the partner's tid.
+ * Returns:
+ *   0.
+ */
+static int bouncer(void *arg) {
+    tid_t partner = *(tid_t *)arg;
+    while (!stop) {
+        lwp_yield_to(partner);
+    }
+    return 0;
+}
+
+static lwp_sem ping, pong;
+
+/*
+ * Description:
+ *   LWP body that answers every post on ping with one on pong until
+ *   told to stop.
+ * Parameters:
+ *   Unused.
+ * Returns:
+ *   0.
+ */
+static int ponger(void *arg) {
+    (void)arg;
+    for (;;) {
+        lwp_sem_wait(&ping);
+        if (stop) {
+            return 0;
+        }
+        lwp_sem_post(&pong);
+    }
+}
+
+static lwp_chan *chan_in, *chan_out;
+
+/*
+ * Description:
+ *   LWP body that sends back every value it receives on chan_in until
+ *   the channel is closed.
+ * Parameters:
+ *   Unused.
+ * Returns:
+ *   0.
+ */
+static int echoer(void *arg) {
+    long v;
+    (void)arg;
+    while (lwp_chan_recv(chan_in, &v) == 0) {
+        lwp_chan_send(chan_out, &v);
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ *   LWP body that exits as soon as it first runs.
+ * Parameters:
+ *   Unused.
+ * Returns:
+ *   0.
+ */
+static int nothing(void *arg) {
+    (void)arg;
+    return 0;
+}
+
+/*
+ * Description:
+ *   Creates n threads running fun.
+ * Parameters:
+ *   The count, the body, an optional array to receive the tids, and
+ *   the attributes to create them with (NULL for the defaults).
+ * Returns:
+ *   0 on success, -1 if a create failed.
+ */
+static int spawn(long n, lwpfun fun, tid_t *tids, lwp_attr *attr) {
+    long i;
+    for (i = 0; i < n; i++) {
+        tid_t t = lwp_create_ex(fun, NULL, attr);
+        if (t == NO_THREAD) {
+            fprintf(stderr, "lwp_bench: lwp_create failed at %ld\n", i);
+            return -1;
+        }
+        if (tids != NULL) {
+            tids[i] = t;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ *   Lets every spawned thread finish and reaps n of them.
+ * Parameters:
+ *   The number of threads to reap.
+ * Returns:
+ *   Nothing.
+ */
+static void reap(long n) {
+    long i;
+    stop = TRUE;
+    for (i = 0; i < n; i++) {
+        lwp_wait(NULL);
+    }
+    stop = FALSE;
+}
+
+/*
+ * Description:
+ *   Runs op iters times per sample until enough samples are taken or
+ *   the point's time budget runs out. The first call sizes iters.
+ * Parameters:
+ *   The result to fill, the operation, its argument, and the number
+ *   of basic operations a single call of op performs.
+ * Returns:
+ *   Nothing.
+ */
+static void measure(result *r, void (*op)(long, void *), void *arg,
+                    long per_call) {
+    long iters = 1;
+    unsigned long start, elapsed, began;
+
+    for (;;) {
+        start = lwp_now_ns();
+        op(iters, arg);
+        elapsed = lwp_now_ns() - start;
+        if (elapsed >= SAMPLE_NS || iters >= (1L << 24)) {
+            break;
+        }
+        iters *= 2;
+    }
+    /* warm up and calibrate */
+
+    r->iters = iters * per_call;
+    r->nsamples = 0;
+    began = lwp_now_ns();
+    while (r->nsamples < MAX_SAMPLES) {
+        start = lwp_now_ns();
+        op(iters, arg);
+        elapsed = lwp_now_ns() - start;
+        r->ns[r->nsamples++] = (double)elapsed / (double)r->iters;
+        if (r->nsamples >= MIN_SAMPLES && lwp_now_ns() - began > POINT_NS) {
+            break;
+        }
+    }
+}
+
+/*
+ * Description:
+ *   qsort comparator for doubles.
+ */
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Description:
+ *   Prints one result as a table row or a JSON object.
+ * Parameters:
+ *   The result.
+ * Returns:
+ *   Nothing.
+ */
+static void report(result *r) {
+    double sum = 0;
+    int i, n = r->nsamples;
+
+    qsort(r->ns, n, sizeof(double), cmp_double);
+    for (i = 0; i < n; i++) {
+        sum += r->ns[i];
+    }
+    double p50 = r->ns[n / 2];
+    double p90 = r->ns[(n * 90) / 100];
+    double p99 = r->ns[(n * 99) / 100];
+
+    if (json) {
+        printf("%s\n    {\"name\": \"%s\", \"threads\": %ld, "
+               "\"ops_per_sample\": %ld, \"samples\": %d, "
+               "\"ns_per_op\": {\"mean\": %.2f, \"min\": %.2f, "
+               "\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, "
+               "\"max\": %.2f}}",
+               printed ? "," : "", r->name, r->threads, r->iters, n,
+               sum / n, r->ns[0], p50, p90, p99, r->ns[n - 1]);
+    } else {
+        if (printed == 0) {
+            printf("%-18s %8s %10s %10s %10s %10s %10s\n", "benchmark",
+                   "threads", "mean", "p50", "p90", "p99", "max");
+        }
+        printf("%-18s %8ld %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+               r->name, r->threads, sum / n, p50, p90, p99, r->ns[n - 1]);
+    }
+    printed++;
+    fflush(stdout);
+}
+
+/*
+ * Description:
+ *   op: n yields by the main thread. With k spinners in the queue each
+ *   yield comes back after k + 1 switches.
+ */
+static void op_yield(long n, void *arg) {
+    long i;
+    (void)arg;
+    for (i = 0; i < n; i++) {
+        lwp_yield();
+    }
+}
+
+/*
+ * Description:
+ *   op: n directed yields to the thread whose tid arg points to.
+ */
+static void op_yield_to(long n, void *arg) {
+    tid_t to = *(tid_t *)arg;
+    long i;
+    for (i = 0; i < n; i++) {
+        lwp_yield_to(to);
+    }
+}
+
+/*
+ * Description:
+ *   op: n round trips through ping and pong. Both sides wait off the
+ *   run queue, so each one is two switches.
+ */
+static void op_sem(long n, void *arg) {
+    long i;
+    (void)arg;
+    for (i = 0; i < n; i++) {
+        lwp_sem_post(&ping);
+        lwp_sem_wait(&pong);
+    }
+}
+
+/*
+ * Description:
+ *   op: n round trips through two unbuffered channels. Each message
+ *   goes straight to the waiting receiver, so each trip is two
+ *   switches.
+ */
+static void op_chan(long n, void *arg) {
+    long i;
+    (void)arg;
+    for (i = 0; i < n; i++) {
+        lwp_chan_send(chan_in, &i);
+        lwp_chan_recv(chan_out, &i);
+    }
+}
+
+/*
+ * Description:
+ *   op: n create/exit/wait cycles with the given lwp_attr (or NULL).
+ */
+static void op_churn(long n, void *arg) {
+    long i;
+    for (i = 0; i < n; i++) {
+        lwp_create_ex(nothing, NULL, arg);
+        lwp_wait(NULL);
+    }
+}
+
+typedef struct lookup {
+    tid_t *tids;
+    long count;
+} lookup;
+
+static thread volatile sink;
+
+/*
+ * Description:
+ *   op: n tid2thread calls on tids spread over the live set.
+ */
+static void op_lookup(long n, void *arg) {
+    lookup *l = arg;
+    unsigned long x = 88172645463325252UL;
+    long i;
+    for (i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        sink = tid2thread(l->tids[x % l->count]);
+    }
+}
+
+static struct scheduler rr_copy;
+
+/*
+ * Description:
+ *   Steps a thread-count sweep: 2, 10, 100, ... and finally max.
+ * Parameters:
+ *   The current count and the largest one to measure.
+ * Returns:
+ *   The next count, or 0 when the sweep is done.
+ */
+static long next_size(long n, long max) {
+    if (n >= max) {
+        return 0;
+    }
+    long next = (n < 10) ? 10 : n * 10;
+    return (next > max) ? max : next;
+}
+
+/*
+ * Description:
+ *   op: n scheduler migrations, alternating between two RR tuples so
+ *   that every call really moves the run queue.
+ */
+static void op_migrate(long n, void *arg) {
+    long i;
+    (void)arg;
+    for (i = 0; i < n; i++) {
+        lwp_set_scheduler((i & 1) ? NULL : &rr_copy);
+    }
+}
+
+/*
+ * Description:
+ *   Runs every benchmark and prints the results.
+ * Parameters:
+ *   -j for JSON output, -n for the largest thread count (default
+ *   10000; the sweeps go up by 10x from 2), -m to cap the migration
+ *   sweep separately.
+ * Returns:
+ *   0 on success, 1 on error.
+ */
+int main(int argc, char *argv[]) {
+    long max = DEFAULT_MAX, maxmig = -1, n;
+    int opt;
+    result r;
+    lwp_attr shared = {0};
+
+    while ((opt = getopt(argc, argv, "jn:m:")) != -1) {
+        switch (opt) {
+        case 'j':
+            json = TRUE;
+            break;
+        case 'n':
+            max = atol(optarg);
+            break;
+        case 'm':
+            maxmig = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-j] [-n maxthreads] "
+                    "[-m maxmigrate]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (max < 2) {
+        max = 2;
+    }
+    if (maxmig < 0) {
+        maxmig = max;
+    }
+
+    lwp_start();
+    /* main is now an LWP and can take part in the runs */
+    if (json) {
+        printf("{\"benchmarks\": [");
+    }
+
+    if (spawn(1, spinner, NULL, NULL) == -1) {
+        return 1;
+    }
+    r.name = "yield_pingpong";
+    r.threads = 2;
+    measure(&r, op_yield, NULL, 2);
+    report(&r);
+    reap(1);
+
+    tid_t self = lwp_gettid();
+    tid_t peer = lwp_create(bouncer, &self);
+    if (peer == NO_THREAD) {
+        return 1;
+    }
+    r.name = "yield_to_pingpong";
+    r.threads = 2;
+    measure(&r, op_yield_to, &peer, 2);
+    report(&r);
+    reap(1);
+
+    lwp_sem_init(&ping, 0);
+    lwp_sem_init(&pong, 0);
+    if (spawn(1, ponger, NULL, NULL) == -1) {
+        return 1;
+    }
+    r.name = "sem_pingpong";
+    r.threads = 2;
+    measure(&r, op_sem, NULL, 2);
+    report(&r);
+    stop = TRUE;
+    lwp_sem_post(&ping);
+    reap(1);
+
+    chan_in = lwp_chan_new(sizeof(long), 0);
+    chan_out = lwp_chan_new(sizeof(long), 0);
+    if (chan_in == NULL || chan_out == NULL
+        || spawn(1, echoer, NULL, NULL) == -1) {
+        return 1;
+    }
+    r.name = "chan_pingpong";
+    r.threads = 2;
+    measure(&r, op_chan, NULL, 2);
+    report(&r);
+    lwp_chan_close(chan_in);
+    reap(1);
+    lwp_chan_free(chan_in);
+    lwp_chan_free(chan_out);
+
+    for (n = 2; n > 0; n = next_size(n, max)) {
+        if (spawn(n - 1, spinner, NULL, NULL) == -1) {
+            return 1;
+        }
+        r.name = "yield_roundrobin";
+        r.threads = n;
+        measure(&r, op_yield, NULL, n);
+        report(&r);
+        reap(n - 1);
+    }
+
+    lwp_set_scheduler(RingRobin);
+    for (n = 2; n > 0; n = next_size(n, max)) {
+        if (spawn(n - 1, spinner, NULL, NULL) == -1) {
+            return 1;
+        }
+        r.name = "yield_ring";
+        r.threads = n;
+        measure(&r, op_yield, NULL, n);
+        report(&r);
+        reap(n - 1);
+    }
+    lwp_set_scheduler(NULL);
+    /* the same rotation on the array-backed ring */
+
+    shared.flags = LWP_SHARED;
+    for (n = 2; n > 0; n = next_size(n, max)) {
+        if (spawn(n - 1, spinner, NULL, &shared) == -1) {
+            return 1;
+        }
+        r.name = "yield_shared";
+        r.threads = n;
+        measure(&r, op_yield, NULL, n);
+        report(&r);
+        reap(n - 1);
+    }
+    /* the same rotation with every spinner copying its frames on and
+       off the shared stacks */
+
+    r.name = "create_exit_wait";
+    r.threads = 1;
+    measure(&r, op_churn, NULL, 1);
+    report(&r);
+
+    lwp_attr instack = {0};
+    instack.flags = LWP_INSTACK;
+    r.name = "create_instack";
+    measure(&r, op_churn, &instack, 1);
+    report(&r);
+
+    for (n = 10; n > 0; n = next_size(n, max)) {
+        lookup l;
+        l.count = n;
+        l.tids = malloc(n * sizeof(tid_t));
+        if (l.tids == NULL || spawn(n, nothing, l.tids, NULL) == -1) {
+            return 1;
+        }
+        r.name = "tid2thread";
+        r.threads = n;
+        measure(&r, op_lookup, &l, 1);
+        report(&r);
+        reap(n);
+        free(l.tids);
+    }
+
+    rr_copy = *lwp_get_scheduler();
+    for (n = 10; n > 0 && maxmig >= 10; n = next_size(n, maxmig)) {
+        if (spawn(n, nothing, NULL, NULL) == -1) {
+            return 1;
+        }
+        r.name = "set_scheduler";
+        r.threads = n;
+        measure(&r, op_migrate, NULL, 1);
+        report(&r);
+        reap(n);
+    }
+
+    if (json) {
+        printf("\n]}\n");
+    }
+    return 0;
+}
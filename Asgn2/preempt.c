@@ -0,0 +1,162 @@
+/*
+ * Description: This file contains the opt-in preemptive time slicing.
+ *              A POSIX timer sends LWP_PREEMPT_SIG every quantum; if the
+ *              running LWP has held the CPU since the previous tick, the
+ *              handler yields on its behalf. The interrupted registers
+ *              (general, FP and vector) are in the kernel's signal frame
+ *              on that LWP's own stack, so they come back when it is next
+ *              switched to and the handler returns.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+volatile sig_atomic_t lwp_critical = FALSE;     /* inside the library */
+unsigned long lwp_switches = 0;                 /* bumped per switch  */
+
+static volatile sig_atomic_t pending = FALSE;   /* tick came in a critical
+                                                   section */
+static volatile sig_atomic_t disabled = 0;      /* lwp_preempt_disable() */
+static unsigned long seen = 0;                  /* lwp_switches at last tick */
+static timer_t timer;
+static int have_timer = FALSE;
+
+/*
+ * Description:
+ *   Timer signal handler. A thread that switched since the last tick
+ *   gets to keep going; one that did not is made to yield, or to yield
+ *   as soon as it leaves its critical section.
+ * Parameters:
+ *   The signal (unused).
+ * Returns:
+ *   Nothing, possibly much later.
+ */
+static void tick(int sig) {
+    int saved = errno;
+    (void)sig;
+    if (running == NULL || lwp_switches != seen) {
+        seen = lwp_switches;
+    } else if (lwp_critical || disabled > 0) {
+        pending = TRUE;
+    } else {
+        lwp_yield();
+    }
+    errno = saved;
+}
+
+/*
+ * Description:
+ *   Marks the start of library code that must not be preempted.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Whether the caller was already in such code, for preempt_leave().
+ */
+int preempt_enter(void) {
+    int was = lwp_critical;
+    lwp_critical = TRUE;
+    return was;
+}
+
+/*
+ * Description:
+ *   Marks the end of a section started by preempt_enter(). A tick that
+ *   came in meanwhile is acted on now.
+ * Parameters:
+ *   What preempt_enter() returned.
+ * Returns:
+ *   Nothing.
+ */
+void preempt_leave(int was) {
+    lwp_critical = was;
+    if (was == FALSE && pending && disabled == 0) {
+        pending = FALSE;
+        lwp_yield();
+    }
+}
+
+/*
+ * Description:
+ *   Starts a section of the calling LWP that must not be preempted.
+ *   Sections nest. Anything that is not async-signal-safe (malloc,
+ *   stdio, ...) must be called inside one when preemption is on; see
+ *   lwp.h.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void lwp_preempt_disable(void) {
+    disabled++;
+}
+
+/*
+ * Description:
+ *   Ends a section started by lwp_preempt_disable().
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void lwp_preempt_enable(void) {
+    if (disabled > 0 && --disabled == 0 && pending && !lwp_critical) {
+        pending = FALSE;
+        lwp_yield();
+    }
+}
+
+/*
+ * Description:
+ *   Turns preemptive time slicing on, changes its quantum, or turns it
+ *   off. A thread that runs a whole quantum without switching is made
+ *   to yield, so it runs for between one and two quanta at a time.
+ * Parameters:
+ *   The quantum in microseconds, or 0 to turn preemption off.
+ * Returns:
+ *   0 on success, -1 on error.
+ */
+int lwp_preempt(unsigned long quantum_us) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+
+    if (have_timer == FALSE) {
+        if (quantum_us == 0) {
+            return 0;
+        }
+        struct sigaction sa;
+        sa.sa_handler = tick;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART | SA_NODEFER;
+        /* not blocked in the handler: it may switch away and the
+           next thread has to keep getting ticks */
+        if (sigaction(LWP_PREEMPT_SIG, &sa, NULL) == -1) {
+            perror("sigaction");
+            return -1;
+        }
+        struct sigevent sev;
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_SIGNAL;
+        sev.sigev_signo = LWP_PREEMPT_SIG;
+        if (timer_create(CLOCK_MONOTONIC, &sev, &timer) == -1) {
+            perror("timer_create");
+            return -1;
+        }
+        have_timer = TRUE;
+    }
+
+    its.it_value.tv_sec = quantum_us / 1000000;
+    its.it_value.tv_nsec = (quantum_us % 1000000) * 1000;
+    its.it_interval = its.it_value;
+    seen = lwp_switches;
+    if (timer_settime(timer, 0, &its, NULL) == -1) {
+        perror("timer_settime");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * Description: This file contains the priority scheduler library. Each of
+ *              the LWP_PRIO_LEVELS levels is a FIFO, and a bitmap of the
+ *              non-empty ones finds the best level with one find-first-set,
+ *              so picking the next thread is O(1). Level 0 runs first;
+ *              threads on the same level take turns.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include "schedulers.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static Queue *levels[LWP_PRIO_LEVELS];
+static unsigned long nonempty = 0;     /* bit i: levels[i] has threads */
+static int total = 0;
+
+static struct scheduler prio_tuple = {
+    prio_init, prio_shutdown, prio_admit, prio_remove, prio_next, prio_qlen,
+    prio_drain, NULL
+};
+scheduler Priority = &prio_tuple;
+
+/*
+ * Description:
+ *   Initializes the priority scheduler.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void prio_init(void) {
+    int i;
+    for (i = 0; i < LWP_PRIO_LEVELS; i++) {
+        if (levels[i] == NULL) {
+            levels[i] = startup(FALSE);
+            if (levels[i] == NULL) {
+                perror("error initializing priority levels");
+                return;
+            }
+        }
+    }
+}
+
+/*
+ * Description:
+ *   Shuts down the priority scheduler.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void prio_shutdown(void) {
+    int i;
+    if (total != 0) {
+        return;
+    }
+    for (i = 0; i < LWP_PRIO_LEVELS; i++) {
+        if (levels[i] != NULL) {
+            shutdown(levels[i]);
+            levels[i] = NULL;
+        }
+    }
+}
+
+/*
+ * Description:
+ *   Finds the level a thread belongs on, setting things up if needed.
+ * Parameters:
+ *   The thread.
+ * Returns:
+ *   Its level's queue, or NULL on error.
+ */
+static Queue *level_of(thread t) {
+    if (levels[0] == NULL) {
+        prio_init();
+    }
+    if (t->priority >= LWP_PRIO_LEVELS) {
+        t->priority = LWP_PRIO_LEVELS - 1;
+    }
+    return levels[t->priority];
+}
+
+/*
+ * Description:
+ *   Adds a thread to the back of its priority level.
+ * Parameters:
+ *   The new thread to add.
+ * Returns:
+ *   Nothing.
+ */
+void prio_admit(thread new) {
+    if (new == NULL) {
+        perror("cannot add NULL thread");
+        return;
+    }
+    Queue *q = level_of(new);
+    if (q == NULL) {
+        return;
+    }
+    enqueue(q, new, FALSE);
+    nonempty |= 1UL << new->priority;
+    total++;
+}
+
+/*
+ * Description:
+ *   Adds a thread to the front of its priority level, so that it is
+ *   the next one picked there.
+ * Parameters:
+ *   The thread to add.
+ * Returns:
+ *   Nothing.
+ */
+void prio_push(thread new) {
+    if (new == NULL) {
+        perror("cannot add NULL thread");
+        return;
+    }
+    Queue *q = level_of(new);
+    if (q == NULL) {
+        return;
+    }
+    push(q, new, FALSE);
+    nonempty |= 1UL << new->priority;
+    total++;
+}
+
+/*
+ * Description:
+ *   Removes a thread from the scheduler.
+ * Parameters:
+ *   The thread to remove.
+ * Returns:
+ *   Nothing.
+ */
+void prio_remove(thread victim) {
+    if (victim == NULL) {
+        perror("cannot remove NULL thread");
+        return;
+    }
+    Queue *q = level_of(victim);
+    if (q == NULL || inqueue(q, victim, FALSE) == FALSE) {
+        return;
+    }
+    dequeue(q, victim, FALSE);
+    if (q->length == 0) {
+        nonempty &= ~(1UL << victim->priority);
+    }
+    total--;
+}
+
+/*
+ * Description:
+ *   Gets the next thread to run.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The first thread of the best non-empty level, or NULL if there
+ *   are no threads.
+ */
+thread prio_next(void) {
+    if (nonempty == 0) {
+        return NULL;
+    }
+    return levels[__builtin_ffsl(nonempty) - 1]->sen->sched_one;
+}
+
+/*
+ * Description:
+ *   Retrieves the number of runnable threads.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The number of runnable threads.
+ */
+int prio_qlen(void) {
+    return total;
+}
+
+/*
+ * Description:
+ *   Moves every runnable thread onto a queue, best level first, each
+ *   level in order.
+ * Parameters:
+ *   The queue to add them to.
+ * Returns:
+ *   Nothing.
+ */
+void prio_drain(Queue *out) {
+    while (nonempty != 0) {
+        int level = __builtin_ffsl(nonempty) - 1;
+        splice(out, levels[level]);
+        nonempty &= ~(1UL << level);
+    }
+    total = 0;
+}
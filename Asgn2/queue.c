@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include "lwp.h"
 #include <stdlib.h>
+#include <assert.h>
 
 /*
  * Description:
@@ -22,13 +23,14 @@ Queue *startup(int lib) {
         perror("allocating global queue");
         return NULL;
     }
-    q->sen = malloc(sizeof(context));
+    q->sen = ctx_alloc();
     if (q->sen == NULL) {
-        perror("error mallocing sen");
         free(q);
         return NULL;
     }
     q->sen->tid = NO_THREAD;
+    q->sen->lib_q = NULL;
+    q->sen->sched_q = NULL;
     if (lib == TRUE) {
         q->sen->lib_one = q->sen;
         q->sen->lib_two = q->sen;
@@ -43,7 +45,8 @@ Queue *startup(int lib) {
 
 /*
  * Description:
- *   Adds a thread to the end of a queue.
+ *   Adds a thread to the end of a queue. The thread must not already be
+ *   on a queue through the same pair of links.
  * Parameters:
  *   The queue being mutated and the thread to add.
  * Returns:
@@ -51,52 +54,153 @@ Queue *startup(int lib) {
  */
 void enqueue(Queue *q, thread t, int lib) {
     if (lib == TRUE) {
+        assert(t->lib_q == NULL);
         t->lib_one = q->sen;
         t->lib_two = q->sen->lib_two;
         q->sen->lib_two->lib_one = t;
         q->sen->lib_two = t;
+        t->lib_q = q;
     } else {
+        assert(t->sched_q == NULL);
         t->sched_one = q->sen;
         t->sched_two = q->sen->sched_two;
         q->sen->sched_two->sched_one = t;
         q->sen->sched_two = t;
+        t->sched_q = q;
     }
     q->length++;
 }
 
 /*
  * Description:
- *   Removes a given thread from a queue.
+ *   Adds a thread to the front of a queue.
  * Parameters:
- *   The queue to mutate and the thread to remove.
+ *   The queue being mutated and the thread to add.
  * Returns:
  *   Nothing.
  */
-void dequeue(Queue *q, thread t, int lib) {
-    thread cur = q->sen;
+void push(Queue *q, thread t, int lib) {
     if (lib == TRUE) {
-        while (cur->lib_one != q->sen && cur != t) {
-            cur = cur->lib_one;
-        }
-        if (cur == t) {
-            cur->lib_two->lib_one = cur->lib_one;
-            cur->lib_one->lib_two = cur->lib_two;
-            cur->lib_one = NULL;
-            cur->lib_two = NULL;
-            q->length--;
-        }
+        assert(t->lib_q == NULL);
+        t->lib_two = q->sen;
+        t->lib_one = q->sen->lib_one;
+        q->sen->lib_one->lib_two = t;
+        q->sen->lib_one = t;
+        t->lib_q = q;
     } else {
-        while (cur->sched_one != q->sen && cur != t) {
-            cur = cur->sched_one;
-        }
+        assert(t->sched_q == NULL);
+        t->sched_two = q->sen;
+        t->sched_one = q->sen->sched_one;
+        q->sen->sched_one->sched_two = t;
+        q->sen->sched_one = t;
+        t->sched_q = q;
+    }
+    q->length++;
+}
+
+#ifdef LWP_DEBUG
+/*
+ * Description:
+ *   Walks a queue to check that a thread really is on it. Only built
+ *   with LWP_DEBUG, since it is as slow as the search it replaces.
+ * Parameters:
+ *   The queue, the thread and which links to follow.
+ * Returns:
+ *   TRUE if the thread was found.
+ */
+static int walk(Queue *q, thread t, int lib) {
+    thread cur;
+    int n = 0;
+    for (cur = lib ? q->sen->lib_one : q->sen->sched_one; cur != q->sen;
+         cur = lib ? cur->lib_one : cur->sched_one) {
         if (cur == t) {
-            cur->sched_two->sched_one = cur->sched_one;
-            cur->sched_one->sched_two = cur->sched_two;
-            cur->sched_one = NULL;
-            cur->sched_two = NULL;
-            q->length--;
+            return TRUE;
         }
+        if (++n > q->length) {
+            break;
+        }
+    }
+    return FALSE;
+}
+#endif
+
+/*
+ * Description:
+ *   Tells whether a thread is on a queue.
+ * Parameters:
+ *   The queue, the thread and which links (lib or sched) to check.
+ * Returns:
+ *   TRUE or FALSE.
+ */
+int inqueue(Queue *q, thread t, int lib) {
+    int in = ((lib == TRUE) ? t->lib_q : t->sched_q) == q;
+#ifdef LWP_DEBUG
+    assert(in == walk(q, t, lib));
+#endif
+    return in;
+}
+
+/*
+ * Description:
+ *   Removes a given thread from a queue. Does nothing if the thread is
+ *   not on that queue.
+ * Parameters:
+ *   The queue to mutate and the thread to remove.
+ * Returns:
+ *   Nothing.
+ */
+void dequeue(Queue *q, thread t, int lib) {
+    if (inqueue(q, t, lib) == FALSE) {
+        return;
+    }
+    if (lib == TRUE) {
+        assert(t->lib_one->lib_two == t && t->lib_two->lib_one == t);
+        t->lib_two->lib_one = t->lib_one;
+        t->lib_one->lib_two = t->lib_two;
+        t->lib_one = NULL;
+        t->lib_two = NULL;
+        t->lib_q = NULL;
+    } else {
+        assert(t->sched_one->sched_two == t && t->sched_two->sched_one == t);
+        t->sched_two->sched_one = t->sched_one;
+        t->sched_one->sched_two = t->sched_two;
+        t->sched_one = NULL;
+        t->sched_two = NULL;
+        t->sched_q = NULL;
     }
+    q->length--;
+}
+
+/*
+ * Description:
+ *   Moves every thread on one queue to the end of another, keeping
+ *   their order, and leaves the first empty. Sched links only.
+ * Parameters:
+ *   The queue to add to and the queue to empty.
+ * Returns:
+ *   Nothing.
+ */
+void splice(Queue *to, Queue *from) {
+    thread cur;
+    if (from->length == 0) {
+        return;
+    }
+    for (cur = from->sen->sched_one; cur != from->sen; cur = cur->sched_one) {
+        cur->sched_q = to;
+    }
+    /* the links move in one go, but each owner has to be updated */
+
+    thread first = from->sen->sched_one;
+    thread last = from->sen->sched_two;
+    first->sched_two = to->sen->sched_two;
+    to->sen->sched_two->sched_one = first;
+    last->sched_one = to->sen;
+    to->sen->sched_two = last;
+    to->length += from->length;
+
+    from->sen->sched_one = from->sen;
+    from->sen->sched_two = from->sen;
+    from->length = 0;
 }
 
 /*
@@ -108,6 +212,6 @@ void dequeue(Queue *q, thread t, int lib) {
  *   Nothing.
  */
 void shutdown(Queue *q) {
-    free(q->sen);
+    ctx_free(q->sen);
         free(q);
 }
@@ -0,0 +1,249 @@
+/*
+ * Description: This file contains a round-robin scheduler that keeps the
+ *              ready threads in a contiguous, growable ring of pointers
+ *              instead of a linked list. Removed threads leave tombstones
+ *              that are skipped as the head rotates past them and
+ *              compacted away when the ring fills up.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include "schedulers.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RING_MIN 64                 /* must be a power of two */
+
+/* Positions only ever grow; a thread's slot in ring is pos & mask.
+   Each thread remembers its position in sched_slot. */
+static thread *ring = NULL;
+static unsigned long mask = 0;
+static unsigned long head = 0;      /* first position in use    */
+static unsigned long tail = 0;      /* one past the last        */
+static unsigned long live = 0;      /* non-tombstone entries    */
+
+static struct scheduler ring_tuple = {
+    ring_init, ring_shutdown, ring_admit, ring_remove, ring_next, ring_qlen,
+    ring_drain, ring_admit_batch
+};
+scheduler RingRobin = &ring_tuple;
+
+/*
+ * Description:
+ *   Initializes the ring scheduler.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void ring_init(void) {
+    if (ring != NULL) {
+        return;
+    }
+    ring = malloc(RING_MIN * sizeof(thread));
+    if (ring == NULL) {
+        perror("error allocating run ring");
+        return;
+    }
+    mask = RING_MIN - 1;
+    head = tail = 0;
+    live = 0;
+}
+
+/*
+ * Description:
+ *   Shuts down the ring scheduler.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void ring_shutdown(void) {
+    if (ring != NULL && live == 0) {
+        free(ring);
+        ring = NULL;
+    }
+}
+
+/*
+ * Description:
+ *   Packs the live entries into the front of a new buffer and
+ *   renumbers their positions.
+ * Parameters:
+ *   The number of slots the new ring should have (a power of two).
+ * Returns:
+ *   0 on success, -1 if the buffer cannot be allocated.
+ */
+static int ring_compact(unsigned long cap) {
+    unsigned long pos, n = 0;
+    thread *to = malloc(cap * sizeof(thread));
+    if (to == NULL) {
+        perror("error compacting run ring");
+        return -1;
+    }
+    for (pos = head; pos != tail; pos++) {
+        thread t = ring[pos & mask];
+        if (t != NULL) {
+            to[n] = t;
+            t->sched_slot = n++;
+        }
+    }
+    free(ring);
+    ring = to;
+    mask = cap - 1;
+    head = 0;
+    tail = n;
+    return 0;
+}
+
+/*
+ * Description:
+ *   Adds a new thread to the back of the ring.
+ * Parameters:
+ *   The new thread to add.
+ * Returns:
+ *   Nothing.
+ */
+void ring_admit(thread new) {
+    if (new == NULL) {
+        perror("cannot add NULL thread");
+        return;
+    }
+    if (ring == NULL) {
+        ring_init();
+    }
+    if (ring == NULL) {
+        return;
+    }
+    if (tail - head > mask) {
+        unsigned long cap = mask + 1;
+        if (live * 2 > cap) {
+            cap *= 2;
+        }
+        if (ring_compact(cap) == -1) {
+            return;
+        }
+    }
+    /* full: squeeze out the tombstones, and grow if that would not
+       free at least half of it */
+
+    ring[tail & mask] = new;
+    new->sched_slot = tail++;
+    live++;
+}
+
+/*
+ * Description:
+ *   Removes a thread from the ring, leaving a tombstone unless it is
+ *   at the head.
+ * Parameters:
+ *   The thread to remove.
+ * Returns:
+ *   Nothing.
+ */
+void ring_remove(thread victim) {
+    if (victim == NULL) {
+        perror("cannot remove NULL thread");
+        return;
+    }
+    unsigned long pos = victim->sched_slot;
+    if (ring == NULL || pos - head >= tail - head
+        || ring[pos & mask] != victim) {
+        return;
+    }
+    /* not in the ring (sched_slot may be left over from before) */
+
+    ring[pos & mask] = NULL;
+    live--;
+    while (head != tail && ring[head & mask] == NULL) {
+        head++;
+    }
+}
+
+/*
+ * Description:
+ *   Gets the next thread to run.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The thread at the head of the ring, or NULL if there is none.
+ */
+thread ring_next(void) {
+    if (live == 0) {
+        return NULL;
+    }
+    return ring[head & mask];
+    /* ring_remove keeps a live entry at the head */
+}
+
+/*
+ * Description:
+ *   Retrieves the number of runnable threads.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The number of runnable threads.
+ */
+int ring_qlen(void) {
+    return (int)live;
+}
+
+/*
+ * Description:
+ *   Moves every runnable thread, in order, onto a queue.
+ * Parameters:
+ *   The queue to add them to.
+ * Returns:
+ *   Nothing.
+ */
+void ring_drain(Queue *out) {
+    unsigned long pos;
+    if (ring == NULL) {
+        return;
+    }
+    for (pos = head; pos != tail; pos++) {
+        if (ring[pos & mask] != NULL) {
+            enqueue(out, ring[pos & mask], FALSE);
+        }
+    }
+    head = tail = 0;
+    live = 0;
+}
+
+/*
+ * Description:
+ *   Adds every thread on a queue, in order, and empties it. The ring
+ *   is sized for all of them at once instead of doubling as it goes.
+ * Parameters:
+ *   The queue of threads to add.
+ * Returns:
+ *   Nothing.
+ */
+void ring_admit_batch(Queue *in) {
+    if (ring == NULL) {
+        ring_init();
+    }
+    if (ring == NULL) {
+        return;
+    }
+    unsigned long need = live + in->length;
+    if (tail - head + in->length > mask + 1) {
+        unsigned long cap = mask + 1;
+        while (cap < 2 * need) {
+            cap *= 2;
+        }
+        if (ring_compact(cap) == -1) {
+            return;
+        }
+    }
+    /* room for all of them, with the same slack ring_admit leaves */
+
+    while (in->length > 0) {
+        thread t = in->sen->sched_one;
+        dequeue(in, t, FALSE);
+        ring[tail & mask] = t;
+        t->sched_slot = tail++;
+        live++;
+    }
+}
@@ -14,29 +14,35 @@ Queue *ready = NULL;
 
 /*
  * Description:
- *   Initializes the round-robin scheduler.
+ *   Initializes the round-robin scheduler. The first time, it also
+ *   becomes the library's scheduler; after that (when
+ *   lwp_set_scheduler() is switching to it) only the ready queue is
+ *   set up.
  * Parameters:
  *   None.
  * Returns:
  *   Nothing.
  */
 void rr_init(void) {
-    sched = malloc(sizeof(struct scheduler));
     if (sched == NULL) {
-        perror("error allocating scheduler");
-        return;
+        sched = malloc(sizeof(struct scheduler));
+        if (sched == NULL) {
+            perror("error allocating scheduler");
+            return;
+        }
+        sched->init = rr_init;
+        sched->shutdown = rr_shutdown;
+        sched->admit = rr_admit;
+        sched->remove = rr_remove;
+        sched->next = rr_next;
+        sched->qlen = rr_qlen;
+        sched->drain = rr_drain;
+        sched->admit_batch = rr_admit_batch;
     }
-    sched->init = rr_init;
-    sched->shutdown = rr_shutdown;
-    sched->admit = rr_admit;
-    sched->remove = rr_remove;
-    sched->next = rr_next;
-    sched->qlen = rr_qlen;
     if (ready == NULL) {
         ready = startup(FALSE);
         if (ready == NULL) {
             perror("error initializing queues");
-            free(sched);
         }
     }
 }
@@ -52,6 +58,7 @@ void rr_init(void) {
 void rr_shutdown(void) {
     if (ready != NULL && ready->length == 0) {
         shutdown(ready);
+        ready = NULL;
     }
 }
 
@@ -68,10 +75,10 @@ void rr_admit(thread new) {
         perror("cannot add NULL thread");
         return;
     }
-    if (sched == NULL) {
+    if (ready == NULL) {
         rr_init();
     }
-    if (sched == NULL) {  // second check after rr_init() to see if fail
+    if (ready == NULL) {  // second check after rr_init() to see if fail
         perror("error initializing rr scheduler");
         return;
     }
@@ -87,10 +94,10 @@ void rr_admit(thread new) {
  *   Nothing.
  */
 void rr_remove(thread victim) {
-    if (sched == NULL) {
+    if (ready == NULL) {
         rr_init();
     }
-    if (sched == NULL) {  // second check after rr_init() to see if fail
+    if (ready == NULL) {  // second check after rr_init() to see if fail
         perror("error initializing rr scheduler");
         return;
     }
@@ -110,7 +117,7 @@ void rr_remove(thread victim) {
  *   The thread to run next, or NULL if there are no more threads.
  */
 thread rr_next(void) {
-    if (sched == NULL) {
+    if (ready == NULL) {
         rr_init();
         return NULL;
     }
@@ -129,9 +136,42 @@ thread rr_next(void) {
  *   The number of runnable threads.
  */
 int rr_qlen(void) {
-    if (sched == NULL) {
+    if (ready == NULL) {
         rr_init();
         return 0;
     }
     return ready->length;
 }
+
+/*
+ * Description:
+ *   Moves every runnable thread, in order, onto a queue.
+ * Parameters:
+ *   The queue to add them to.
+ * Returns:
+ *   Nothing.
+ */
+void rr_drain(Queue *out) {
+    if (ready != NULL) {
+        splice(out, ready);
+    }
+}
+
+/*
+ * Description:
+ *   Adds every thread on a queue, in order, and empties it.
+ * Parameters:
+ *   The queue of threads to add.
+ * Returns:
+ *   Nothing.
+ */
+void rr_admit_batch(Queue *in) {
+    if (ready == NULL) {
+        rr_init();
+    }
+    if (ready == NULL) {
+        perror("error initializing rr scheduler");
+        return;
+    }
+    splice(ready, in);
+}
@@ -6,4 +6,9 @@ extern scheduler AlwaysZero;
 extern scheduler ChangeOnSIGTSTP;
 extern scheduler ChooseHighestColor;
 extern scheduler ChooseLowestColor;
+extern scheduler RingRobin;         /* round robin on a pointer ring */
+extern scheduler Priority;          /* by lwp_set_priority(), RR within */
+extern scheduler Stride;            /* shares by lwp_set_tickets()      */
+extern scheduler Fair;              /* least CPU time (vruntime) first  */
+extern scheduler EarliestDeadline;  /* by lwp_set_deadline(), else RR   */
 #endif
@@ -0,0 +1,75 @@
+/*
+ * Description: This file contains the slab allocator for thread contexts
+ *              (and the queue sentinels, which are contexts too). Contexts
+ *              are carved 64-byte aligned out of larger slabs and recycled
+ *              through per-OS-thread free lists instead of malloc/free.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CTX_ALIGN 64
+#define SLAB_COUNT 64               /* contexts carved per slab */
+
+static __thread thread freelist = NULL;
+/* free contexts are chained through lib_one */
+
+/*
+ * Description:
+ *   Carves a new slab into contexts and puts them on the free list.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   0 on success, -1 if the slab cannot be allocated.
+ */
+static int slab_grow(void) {
+    char *slab = aligned_alloc(CTX_ALIGN, CTX_SPAN * SLAB_COUNT);
+    int i;
+    if (slab == NULL) {
+        perror("error allocating context slab");
+        return -1;
+    }
+    for (i = SLAB_COUNT - 1; i >= 0; i--) {
+        thread t = (thread)(slab + i * CTX_SPAN);
+        t->lib_one = freelist;
+        freelist = t;
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ *   Gets an uninitialized context.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   A 64-byte aligned context, or NULL on error.
+ */
+thread ctx_alloc(void) {
+    if (freelist == NULL && slab_grow() == -1) {
+        return NULL;
+    }
+    thread t = freelist;
+    freelist = t->lib_one;
+    return t;
+}
+
+/*
+ * Description:
+ *   Gives a context from ctx_alloc() back. Slabs are never released;
+ *   their contexts are kept for the next lwp_create.
+ * Parameters:
+ *   The context.
+ * Returns:
+ *   Nothing.
+ */
+void ctx_free(thread t) {
+    if (t == NULL) {
+        return;
+    }
+    t->lib_one = freelist;
+    freelist = t;
+}
@@ -0,0 +1,489 @@
+/*
+ * Description: This file contains the LWP stack cache. Stacks of reaped
+ *              threads are kept in per-size buckets and handed back out
+ *              by lwp_create, so create/exit churn does not mmap/munmap.
+ *              Every stack sits on top of a PROT_NONE guard page,
+ *              until the stacks would use up the process's memory
+ *              mappings (vm.max_map_count).
+ *              Also holds the shared execution stacks used by LWP_SHARED
+ *              threads, which copy their live frames on and off them.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define STACK_BUCKETS 8
+#define DEFAULT_CAP 64                    /* stacks kept per bucket      */
+#define DEFAULT_BUDGET (256UL << 20)      /* bytes left resident at most */
+#define DEFAULT_SHARED 4                  /* shared stacks if unconfigured */
+#define SSAVE_MIN 256                     /* smallest frame save buffer    */
+#define DEFAULT_MAPS 65530                /* vm.max_map_count if unreadable */
+
+#ifdef MADV_FREE
+#define STACK_ADVICE MADV_FREE
+#else
+#define STACK_ADVICE MADV_DONTNEED
+#endif
+
+/* Cached stacks of one size, used LIFO so the most recently freed
+ * (and most likely still resident) stack is reused first. Entries
+ * below cold have already been given back to the kernel with madvise.
+ */
+typedef struct bucket {
+    size_t size;
+    unsigned long **stacks;
+    int count;
+    int cold;
+} bucket;
+
+static bucket buckets[STACK_BUCKETS];
+static int cap = DEFAULT_CAP;
+static size_t budget = DEFAULT_BUDGET;
+static size_t warm = 0;                   /* bytes cached and not advised */
+static size_t guard = 0;                  /* bytes of PROT_NONE under each */
+static unsigned long mapped = 0;          /* live stack mappings          */
+static unsigned long guarded_max = 0;     /* guard only while mapped < it */
+static unsigned long unguarded = 0;       /* stacks mapped without one    */
+
+static sharedstack *shared = NULL;
+static int nshared = 0;
+static int nextshared = 0;
+static unsigned long sharedusers = 0;     /* live LWP_SHARED threads      */
+
+/*
+ * Description:
+ *   Gets the size of the guard region, a page.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The guard size in bytes.
+ */
+static size_t guard_size(void) {
+    if (guard == 0) {
+        long pgsize = sysconf(_SC_PAGESIZE);
+        guard = (pgsize > 0) ? (size_t)pgsize : 4096;
+    }
+    return guard;
+}
+
+/*
+ * Description:
+ *   Works out how many stacks may be mapped before new ones go without
+ *   a guard. A guarded stack is two mappings (the guard splits it), an
+ *   unguarded one merges with its unguarded neighbours, and the kernel
+ *   refuses any mmap once vm.max_map_count is reached. Guards stop at a
+ *   quarter of the limit, leaving half of it for the rest of the process.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The number of stacks that get a guard.
+ */
+static unsigned long guard_limit(void) {
+    if (guarded_max == 0) {
+        long maps = DEFAULT_MAPS;
+        FILE *f = fopen("/proc/sys/vm/max_map_count", "r");
+        if (f != NULL) {
+            if (fscanf(f, "%ld", &maps) != 1 || maps < 4) {
+                maps = DEFAULT_MAPS;
+            }
+            fclose(f);
+        }
+        guarded_max = maps / 4;
+    }
+    return guarded_max;
+}
+
+/*
+ * Description:
+ *   Maps a new stack with a guard page below it. The mapping is not
+ *   charged against overcommit up front, so large mostly-unused stacks
+ *   only cost what they touch. Past guard_limit() live stacks, or if
+ *   mprotect runs out of mappings anyway, the guard page is left
+ *   readable instead (same layout, no fault on overflow).
+ * Parameters:
+ *   The size in bytes (a multiple of the page size).
+ * Returns:
+ *   The base of the usable stack (just above the guard), or NULL on
+ *   error.
+ */
+static unsigned long *stack_map(size_t size) {
+    size_t g = guard_size();
+    char *base = mmap(NULL, size + g,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                      -1, 0);
+    if (base == MAP_FAILED) {
+        perror("error mmaping new thread stack");
+        return NULL;
+    }
+    if (mapped < guard_limit() && mprotect(base, g, PROT_NONE) == 0) {
+        mapped++;
+        return (unsigned long *)(base + g);
+    }
+    if (mapped < guard_limit() && errno != ENOMEM) {
+        perror("error protecting stack guard");
+        munmap(base, size + g);
+        return NULL;
+    }
+    if (unguarded++ == 0) {
+        fprintf(stderr, "lwp: near vm.max_map_count, stacks made "
+                "from now on may have no guard page\n");
+    }
+    mapped++;
+    return (unsigned long *)(base + g);
+}
+
+/*
+ * Description:
+ *   Unmaps a stack and its guard.
+ * Parameters:
+ *   Its base and size.
+ * Returns:
+ *   0 on success, -1 on error.
+ */
+static int stack_unmap(unsigned long *stack, size_t size) {
+    size_t g = guard_size();
+    if (munmap((char *)stack - g, size + g) == -1) {
+        perror("error munmap");
+        return -1;
+    }
+    mapped--;
+    return 0;
+}
+
+/*
+ * Description:
+ *   Checks whether a faulting address is in a stack's guard page.
+ * Parameters:
+ *   The base of a stack from stack_get() and the address.
+ * Returns:
+ *   TRUE if it is, FALSE otherwise.
+ */
+int stack_in_guard(unsigned long *stack, void *addr) {
+    char *top = (char *)stack;
+    return (char *)addr < top && (char *)addr >= top - guard_size();
+}
+
+/*
+ * Description:
+ *   Finds the bucket for a stack size, claiming an empty one if
+ *   needed.
+ * Parameters:
+ *   The size.
+ * Returns:
+ *   The bucket, or NULL if every bucket holds some other size.
+ */
+static bucket *find_bucket(size_t size) {
+    int i;
+    bucket *empty = NULL;
+    for (i = 0; i < STACK_BUCKETS; i++) {
+        if (buckets[i].size == size) {
+            return &buckets[i];
+        }
+        if (empty == NULL && buckets[i].count == 0) {
+            empty = &buckets[i];
+        }
+    }
+    if (empty != NULL) {
+        empty->size = size;
+    }
+    return empty;
+}
+
+/*
+ * Description:
+ *   Advises the oldest warm stacks away until the cache fits its
+ *   resident budget again.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+static void trim(void) {
+    int i;
+    for (i = 0; i < STACK_BUCKETS && warm > budget; i++) {
+        bucket *b = &buckets[i];
+        while (b->cold < b->count && warm > budget) {
+            if (madvise(b->stacks[b->cold], b->size, STACK_ADVICE) == -1
+                && madvise(b->stacks[b->cold], b->size,
+                           MADV_DONTNEED) == -1) {
+                perror("madvise");
+                return;
+            }
+            /* MADV_FREE is missing on older kernels */
+            b->cold++;
+            warm -= b->size;
+        }
+    }
+}
+
+/*
+ * Description:
+ *   Gets a stack, from the cache if one of the right size is there.
+ * Parameters:
+ *   The size in bytes (a multiple of the page size).
+ * Returns:
+ *   The base of the stack, or NULL on error.
+ */
+unsigned long *stack_get(size_t size) {
+    bucket *b = find_bucket(size);
+    if (b == NULL || b->count == 0) {
+        return stack_map(size);
+    }
+    unsigned long *stack = b->stacks[--b->count];
+    if (b->count < b->cold) {
+        b->cold = b->count;
+    } else {
+        warm -= size;
+    }
+    return stack;
+}
+
+/*
+ * Description:
+ *   Returns a stack to the cache, or unmaps it if the cache is full.
+ * Parameters:
+ *   The base of the stack and its size.
+ * Returns:
+ *   0 on success, -1 on error.
+ */
+int stack_put(unsigned long *stack, size_t size) {
+    bucket *b = find_bucket(size);
+    if (b == NULL || cap == 0 || b->count >= cap) {
+        return stack_unmap(stack, size);
+    }
+    if (b->stacks == NULL) {
+        b->stacks = malloc(cap * sizeof(unsigned long *));
+        if (b->stacks == NULL) {
+            perror("error allocating stack cache");
+            return stack_unmap(stack, size);
+        }
+    }
+    b->stacks[b->count++] = stack;
+    warm += size;
+    trim();
+    return 0;
+}
+
+/*
+ * Description:
+ *   Configures the stack cache. Stacks already cached beyond the new
+ *   limits are released.
+ * Parameters:
+ *   The most stacks to keep per size (0 turns the cache off) and the
+ *   number of cached bytes allowed to stay resident; anything past
+ *   that is kept mapped but handed back with madvise.
+ * Returns:
+ *   Nothing.
+ */
+void lwp_stack_cache(int newcap, size_t newbudget) {
+    int i;
+    if (newcap < 0) {
+        newcap = 0;
+    }
+    for (i = 0; i < STACK_BUCKETS; i++) {
+        bucket *b = &buckets[i];
+        while (b->count > newcap) {
+            unsigned long *stack = b->stacks[--b->count];
+            if (b->count < b->cold) {
+                b->cold = b->count;
+            } else {
+                warm -= b->size;
+            }
+            stack_unmap(stack, b->size);
+        }
+        if (b->count == 0 || newcap == 0) {
+            free(b->stacks);
+            b->stacks = NULL;
+            /* stack_put makes one of the new size on demand */
+        } else {
+            unsigned long **stacks = realloc(b->stacks,
+                                             newcap * sizeof(*stacks));
+            if (stacks == NULL) {
+                perror("error resizing stack cache");
+                return;
+            }
+            b->stacks = stacks;
+        }
+    }
+    cap = newcap;
+    budget = newbudget;
+    trim();
+}
+
+/*
+ * Description:
+ *   Sets up the shared execution stacks used by LWP_SHARED threads.
+ *   Can only be changed while no such thread exists.
+ * Parameters:
+ *   How many stacks to share the threads over, and the size of each.
+ *   More stacks means fewer copies when threads alternate; each is
+ *   only resident as deep as its deepest tenant has gone.
+ * Returns:
+ *   0 on success, -1 on error.
+ */
+int lwp_shared_stacks(int count, size_t size) {
+    int i;
+    long pgsize = sysconf(_SC_PAGESIZE);
+    if (count < 1 || size == 0 || pgsize == -1) {
+        perror("bad shared stack configuration");
+        return -1;
+    }
+    if (sharedusers > 0) {
+        perror("shared stacks are in use");
+        return -1;
+    }
+    if (size % pgsize != 0) {
+        size += pgsize - size % pgsize;
+    }
+
+    sharedstack *fresh = malloc(count * sizeof(sharedstack));
+    if (fresh == NULL) {
+        perror("error allocating shared stacks");
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        fresh[i].size = size;
+        fresh[i].owner = NULL;
+        fresh[i].base = stack_get(size);
+        if (fresh[i].base == NULL) {
+            while (i-- > 0) {
+                stack_put(fresh[i].base, size);
+            }
+            free(fresh);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < nshared; i++) {
+        stack_put(shared[i].base, shared[i].size);
+    }
+    free(shared);
+    shared = fresh;
+    nshared = count;
+    nextshared = 0;
+    return 0;
+}
+
+/*
+ * Description:
+ *   Assigns a new LWP_SHARED thread to a shared stack, round robin,
+ *   setting the stacks up with defaults the first time if needed.
+ * Parameters:
+ *   The size to use if the stacks have to be created.
+ * Returns:
+ *   The stack, or NULL on error.
+ */
+sharedstack *shared_pick(size_t size) {
+    if (nshared == 0 && lwp_shared_stacks(DEFAULT_SHARED, size) == -1) {
+        return NULL;
+    }
+    sharedstack *s = &shared[nextshared];
+    nextshared = (nextshared + 1) % nshared;
+    sharedusers++;
+    return s;
+}
+
+/*
+ * Description:
+ *   Releases a reaped LWP_SHARED thread's save buffer.
+ * Parameters:
+ *   The thread.
+ * Returns:
+ *   Nothing.
+ */
+void shared_release(thread t) {
+    if (t->shared->owner == t) {
+        t->shared->owner = NULL;
+    }
+    free(t->ssave);
+    t->ssave = NULL;
+    t->ssavecap = 0;
+    t->ssavelen = 0;
+    sharedusers--;
+}
+
+/*
+ * Description:
+ *   Makes sure a thread's save buffer can hold len bytes. It is also
+ *   shrunk when it has become far bigger than what the thread uses.
+ * Parameters:
+ *   The thread and the number of bytes.
+ * Returns:
+ *   0 on success, -1 on error.
+ */
+int shared_reserve(thread t, size_t len) {
+    size_t want = t->ssavecap;
+    if (want < SSAVE_MIN) {
+        want = SSAVE_MIN;
+    }
+    while (want < len) {
+        want *= 2;
+    }
+    while (want > SSAVE_MIN && len * 4 < want) {
+        want /= 2;
+    }
+    if (want != t->ssavecap) {
+        void *buf = realloc(t->ssave, want);
+        if (buf == NULL) {
+            perror("error growing shared stack save buffer");
+            return -1;
+        }
+        t->ssave = buf;
+        t->ssavecap = want;
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ *   Copies a thread's live frames (its saved rsp up to the top of its
+ *   shared stack) into its save buffer. The thread must be switched
+ *   out and must currently own the stack.
+ * Parameters:
+ *   The thread.
+ * Returns:
+ *   Nothing. Exits if the buffer cannot grow, since the frames would
+ *   otherwise be lost.
+ */
+static void shared_save(thread t) {
+    char *top = (char *)t->shared->base + t->shared->size;
+    size_t len = top - (char *)t->cstate.rsp;
+    if (shared_reserve(t, len) == -1) {
+        exit(1);
+    }
+    memcpy(t->ssave, (char *)t->cstate.rsp, len);
+    t->ssavelen = len;
+    if (len > t->ssavepeak) {
+        t->ssavepeak = len;
+    }
+}
+
+/*
+ * Description:
+ *   Puts a thread's frames back on its shared stack, first saving
+ *   those of whoever owns it now. Must not be called while running on
+ *   that stack.
+ * Parameters:
+ *   The thread about to be switched to.
+ * Returns:
+ *   Nothing.
+ */
+void shared_load(thread t) {
+    sharedstack *s = t->shared;
+    if (s->owner == t) {
+        return;
+    }
+    if (s->owner != NULL) {
+        shared_save(s->owner);
+    }
+    memcpy((char *)s->base + s->size - t->ssavelen, t->ssave, t->ssavelen);
+    s->owner = t;
+}
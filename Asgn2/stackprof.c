@@ -0,0 +1,202 @@
+/*
+ * Description: This file contains opt-in stack high-water-mark profiling.
+ *              Each thread's peak stack use is measured when it exits and
+ *              aggregated per entry function, and can be fed back into
+ *              the stack size of later threads running the same function.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PROF_FUNCS 256              /* distinct entry functions tracked */
+#define AUTOTUNE_MIN 16             /* exits seen before we resize      */
+#define AUTOTUNE_SLACK 2            /* stack = p99 * this               */
+
+/* what we know about one entry function */
+typedef struct stackprof {
+    lwpfun fun;
+    unsigned long count;
+    size_t max;
+    size_t samples[LWP_PROF_SAMPLES];   /* ring of the latest peaks */
+} stackprof;
+
+static stackprof table[PROF_FUNCS];
+static int profiling = FALSE;
+static int autotune = FALSE;
+static long pgsize = -1;
+
+/*
+ * Description:
+ *   Finds the table slot for a function, optionally claiming one.
+ * Parameters:
+ *   The function and whether to add it if it is missing.
+ * Returns:
+ *   The slot, or NULL if it is missing (or the table is full).
+ */
+static stackprof *lookup(lwpfun fun, int add) {
+    unsigned long h = ((unsigned long)fun >> 4) % PROF_FUNCS;
+    int i;
+    for (i = 0; i < PROF_FUNCS; i++) {
+        stackprof *p = &table[(h + i) % PROF_FUNCS];
+        if (p->fun == fun) {
+            return p;
+        }
+        if (p->fun == NULL) {
+            if (add == FALSE) {
+                return NULL;
+            }
+            p->fun = fun;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Description:
+ *   qsort comparator for sizes.
+ */
+static int cmp_size(const void *a, const void *b) {
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Description:
+ *   Turns stack profiling on or off.
+ * Parameters:
+ *   Whether to record peak stack use at lwp_exit, and whether
+ *   lwp_create should size stacks of functions with enough history
+ *   from their observed p99 instead of the default.
+ * Returns:
+ *   Nothing.
+ */
+void lwp_stack_profile(int enable, int tune) {
+    profiling = enable;
+    autotune = enable && tune;
+    if (pgsize == -1) {
+        pgsize = sysconf(_SC_PAGESIZE);
+    }
+}
+
+/*
+ * Description:
+ *   Reports what has been seen for an entry function.
+ * Parameters:
+ *   The function and where to put the numbers (all in bytes).
+ * Returns:
+ *   0 on success, -1 if nothing has been recorded for it.
+ */
+int lwp_stack_stats(lwpfun fun, lwp_stackstat *out) {
+    size_t sorted[LWP_PROF_SAMPLES];
+    stackprof *p = lookup(fun, FALSE);
+    if (p == NULL || p->count == 0 || out == NULL) {
+        return -1;
+    }
+    int n = (p->count < LWP_PROF_SAMPLES) ? p->count : LWP_PROF_SAMPLES;
+    memcpy(sorted, p->samples, n * sizeof(size_t));
+    qsort(sorted, n, sizeof(size_t), cmp_size);
+    out->count = p->count;
+    out->max = p->max;
+    out->p50 = sorted[n / 2];
+    out->p99 = sorted[(n * 99) / 100];
+    return 0;
+}
+
+/*
+ * Description:
+ *   Gets a library stack ready to be measured: pages left resident by
+ *   its last user are dropped so they do not count against the new one.
+ * Parameters:
+ *   The stack from stack_get() and its size.
+ * Returns:
+ *   Nothing.
+ */
+void stackprof_prepare(unsigned long *stack, size_t size) {
+    if (profiling == FALSE) {
+        return;
+    }
+    if (madvise(stack, size, MADV_DONTNEED) == -1) {
+        perror("madvise");
+    }
+}
+
+/*
+ * Description:
+ *   Records how deep an exiting thread's stack went. For its own stack
+ *   that is everything from the lowest resident page up; for a shared
+ *   stack it is the most it ever had to save.
+ * Parameters:
+ *   The exiting thread.
+ * Returns:
+ *   Nothing.
+ */
+void stackprof_record(thread t) {
+    size_t used, i, npages;
+    if (profiling == FALSE || t->fun == NULL
+        || (t->flags & LWP_USERSTACK)) {
+        return;
+    }
+
+    if (t->flags & LWP_SHARED) {
+        used = t->ssavepeak;
+    } else {
+        npages = t->stacksize / pgsize;
+        unsigned char *vec = malloc(npages);
+        if (vec == NULL) {
+            perror("error allocating mincore vector");
+            return;
+        }
+        if (mincore(t->stack, t->stacksize, vec) == -1) {
+            perror("mincore");
+            free(vec);
+            return;
+        }
+        for (i = 0; i < npages && !(vec[i] & 1); i++) {
+        }
+        used = (npages - i) * pgsize;
+        free(vec);
+        if (t->flags & LWP_INSTACK) {
+            used -= (CTX_SPAN + pgsize - 1) & ~(pgsize - 1);
+        }
+        /* the page(s) holding the context are not stack use */
+    }
+
+    stackprof *p = lookup(t->fun, TRUE);
+    if (p == NULL) {
+        return;
+    }
+    p->samples[p->count % LWP_PROF_SAMPLES] = used;
+    p->count++;
+    if (used > p->max) {
+        p->max = used;
+    }
+}
+
+/*
+ * Description:
+ *   Picks the stack size for a new thread when autotuning is on.
+ * Parameters:
+ *   The entry function and the size it would otherwise get.
+ * Returns:
+ *   Twice the observed p99, in whole pages, if the function has enough
+ *   history; otherwise the size passed in. Never more than that size.
+ */
+size_t stackprof_suggest(lwpfun fun, size_t size) {
+    lwp_stackstat st;
+    if (autotune == FALSE || lwp_stack_stats(fun, &st) == -1
+        || st.count < AUTOTUNE_MIN) {
+        return size;
+    }
+    size_t want = st.p99 * AUTOTUNE_SLACK;
+    if (want % pgsize != 0) {
+        want += pgsize - want % pgsize;
+    }
+    return (want < size) ? want : size;
+}
@@ -0,0 +1,217 @@
+/*
+ * Description: This file contains the stride (proportional-share)
+ *              scheduler. Each thread's share of turns is proportional to
+ *              its tickets: every turn advances its pass by
+ *              STRIDE1 / tickets, and the thread with the lowest pass runs
+ *              next. Passes are kept in a min-heap (heap.c).
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include "schedulers.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define STRIDE1 (1UL << 20)
+
+static Heap *passes = NULL;
+static unsigned long global_pass = 0;  /* pass of the last thread picked */
+static thread picked = NULL;           /* which next() handed out */
+static thread turning = NULL;          /* and the remove() right after */
+
+static struct scheduler stride_tuple = {
+    stride_init, stride_shutdown, stride_admit, stride_remove, stride_next,
+    stride_qlen, stride_drain, NULL
+};
+scheduler Stride = &stride_tuple;
+
+/*
+ * Description:
+ *   Works out a thread's stride from its tickets.
+ * Parameters:
+ *   The thread.
+ * Returns:
+ *   The amount its pass goes up per turn.
+ */
+static unsigned long stride_of(thread t) {
+    return STRIDE1 / ((t->tickets > 0) ? t->tickets : 1);
+}
+
+/*
+ * Description:
+ *   Initializes the stride scheduler.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void stride_init(void) {
+    turning = picked = NULL;
+    if (passes == NULL) {
+        passes = heap_new();
+    }
+}
+
+/*
+ * Description:
+ *   Shuts down the stride scheduler.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void stride_shutdown(void) {
+    if (passes != NULL && passes->length == 0) {
+        heap_free(passes);
+        passes = NULL;
+    }
+}
+
+/*
+ * Description:
+ *   Adds a thread. A thread coming back from lwp_yield()'s rotation
+ *   (next(), remove() and admit() of the same thread, nothing in
+ *   between) has used a turn and is charged one stride. Any other
+ *   gets back the part of a stride it still had left (kept in
+ *   sched_key while it was away), measured from the current pass, so
+ *   time spent blocked neither earns nor costs it turns.
+ * Parameters:
+ *   The new thread to add.
+ * Returns:
+ *   Nothing.
+ */
+void stride_admit(thread new) {
+    if (new == NULL) {
+        perror("cannot add NULL thread");
+        return;
+    }
+    if (passes == NULL) {
+        stride_init();
+    }
+    if (passes == NULL) {
+        return;
+    }
+
+    unsigned long stride = stride_of(new);
+    unsigned long key = new->sched_key;
+    unsigned long remain = (key < stride) ? key : stride;
+    /* anything bigger than a stride was left by another scheduler */
+    new->sched_key = global_pass + remain;
+    if (new == turning) {
+        new->sched_key += stride;
+    }
+    turning = NULL;
+    if (heap_push(passes, new) == -1) {
+        new->sched_key = key;
+        perror("cannot add thread to stride scheduler");
+    }
+}
+
+/*
+ * Description:
+ *   Removes a thread from the scheduler, remembering how far ahead of
+ *   the current pass it was.
+ * Parameters:
+ *   The thread to remove.
+ * Returns:
+ *   Nothing.
+ */
+void stride_remove(thread victim) {
+    if (victim == NULL) {
+        perror("cannot remove NULL thread");
+        return;
+    }
+    if (passes == NULL || inheap(passes, victim) == FALSE) {
+        return;
+    }
+    heap_remove(passes, victim);
+    turning = (victim == picked) ? victim : NULL;
+    picked = NULL;
+    victim->sched_key = (victim->sched_key > global_pass)
+                        ? victim->sched_key - global_pass : 0;
+}
+
+/*
+ * Description:
+ *   Gets the next thread to run.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The thread with the lowest pass, or NULL if there are none.
+ */
+thread stride_next(void) {
+    if (passes == NULL) {
+        return NULL;
+    }
+    picked = heap_peek(passes);
+    turning = NULL;
+    if (picked != NULL) {
+        global_pass = picked->sched_key;
+    }
+    return picked;
+}
+
+/*
+ * Description:
+ *   Retrieves the number of runnable threads.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The number of runnable threads.
+ */
+int stride_qlen(void) {
+    return (passes != NULL) ? passes->length : 0;
+}
+
+/*
+ * Description:
+ *   Moves every runnable thread onto a queue, each remembering how far
+ *   ahead of the current pass it was, as stride_remove() does.
+ * Parameters:
+ *   The queue to add them to.
+ * Returns:
+ *   Nothing.
+ */
+void stride_drain(Queue *out) {
+    int i;
+    if (passes == NULL) {
+        return;
+    }
+    for (i = 0; i < passes->length; i++) {
+        thread t = passes->items[i];
+        t->sched_key = (t->sched_key > global_pass)
+                       ? t->sched_key - global_pass : 0;
+    }
+    heap_drain(passes, out);
+    turning = picked = NULL;
+}
+
+/*
+ * Description:
+ *   Sets a thread's tickets. If it is waiting for its turn, what is
+ *   left of its current stride is rescaled to the new stride.
+ * Parameters:
+ *   The tid and the number of tickets (at least 1).
+ * Returns:
+ *   0 on success, -1 if the thread or count is invalid.
+ */
+int lwp_set_tickets(tid_t tid, unsigned int tickets) {
+    thread t = tid2thread(tid);
+    if (t == NULL || tickets == 0) {
+        return -1;
+    }
+    int was = preempt_enter();
+    if (passes != NULL && inheap(passes, t)) {
+        unsigned long old = stride_of(t);
+        unsigned long remain = (t->sched_key > global_pass)
+                               ? t->sched_key - global_pass : 0;
+        t->tickets = tickets;
+        t->sched_key = global_pass + remain * stride_of(t) / old;
+        heap_fix(passes, t);
+    } else {
+        t->tickets = tickets;
+    }
+    preempt_leave(was);
+    return 0;
+}
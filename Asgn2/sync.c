@@ -0,0 +1,503 @@
+/*
+ * Description: This file contains the LWP synchronization primitives:
+ *              mutexes, condition variables and counting semaphores.
+ *              A thread that has to wait is taken out of the scheduler
+ *              and put on the object's FIFO wait list, linked through
+ *              its sched_one/sched_two pointers (free while it is out of
+ *              the scheduler). Releasing hands the object straight to
+ *              the first waiter, so exactly one thread is woken and no
+ *              one can barge in ahead of it. The timed waits arm the
+ *              waiter's own timer to take it back off the list.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Description:
+ *   Adds a thread to the back of a wait list.
+ * Parameters:
+ *   The list and the thread.
+ * Returns:
+ *   Nothing.
+ */
+void wait_append(lwp_waitlist *w, thread t) {
+    t->sched_one = NULL;
+    t->sched_two = w->tail;
+    if (w->tail != NULL) {
+        w->tail->sched_one = t;
+    } else {
+        w->head = t;
+    }
+    w->tail = t;
+    t->wl = w;
+}
+
+/*
+ * Description:
+ *   Takes a thread off a wait list, wherever it is on it.
+ * Parameters:
+ *   The list and the thread (which must be on it).
+ * Returns:
+ *   Nothing.
+ */
+void wait_remove(lwp_waitlist *w, thread t) {
+    if (t->sched_two != NULL) {
+        t->sched_two->sched_one = t->sched_one;
+    } else {
+        w->head = t->sched_one;
+    }
+    if (t->sched_one != NULL) {
+        t->sched_one->sched_two = t->sched_two;
+    } else {
+        w->tail = t->sched_two;
+    }
+    t->sched_one = NULL;
+    t->sched_two = NULL;
+    t->wl = NULL;
+}
+
+/*
+ * Description:
+ *   Takes the first thread off a wait list.
+ * Parameters:
+ *   The list.
+ * Returns:
+ *   That thread, or NULL if the list is empty.
+ */
+thread wait_pop(lwp_waitlist *w) {
+    thread t = w->head;
+    if (t != NULL) {
+        wait_remove(w, t);
+    }
+    return t;
+}
+
+/*
+ * Description:
+ *   Times out a wait: takes the thread off whatever list it is still
+ *   on and wakes it. Too late if it has already been taken off.
+ * Parameters:
+ *   The thread's timer.
+ * Returns:
+ *   Nothing.
+ */
+static void wait_expired(lwp_timer *tm) {
+    thread t = (thread)tm->arg;
+    if (t->wl != NULL) {
+        wait_remove(t->wl, t);
+        t->flags |= LWP_EXPIRED;
+        thread_unpark(t);
+    }
+}
+
+/*
+ * Description:
+ *   Parks the calling thread on a wait list until someone takes it off
+ *   and unparks it, or until a deadline. Must be called inside
+ *   preempt_enter().
+ * Parameters:
+ *   The list and a CLOCK_MONOTONIC deadline in ns, or 0 for none.
+ * Returns:
+ *   0 once woken, LWP_TIMEDOUT if the deadline came first, or -1 at
+ *   once if nothing could ever wake it.
+ */
+int wait_until(lwp_waitlist *w, unsigned long abs_ns) {
+    thread self = running;
+    thread_park(self);
+    if (abs_ns == 0 && !wake_possible()) {
+        thread_unpark(self);
+        return -1;
+    }
+    /* with a deadline, our own timer will */
+    wait_append(w, self);
+    if (abs_ns != 0) {
+        lwp_timer_arm(&self->timer, abs_ns, wait_expired, self);
+    }
+    lwp_yield();
+    if (abs_ns != 0) {
+        lwp_timer_cancel(&self->timer);
+    }
+    if (self->flags & LWP_EXPIRED) {
+        self->flags &= ~LWP_EXPIRED;
+        return LWP_TIMEDOUT;
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ *   Parks the calling thread on a wait list with no deadline; see
+ *   wait_until().
+ * Parameters:
+ *   The list.
+ * Returns:
+ *   0 once woken, or -1 at once if nothing could ever wake it.
+ */
+int wait_on(lwp_waitlist *w) {
+    return wait_until(w, 0);
+}
+
+/*
+ * Description:
+ *   Takes the first thread off a wait list and makes it runnable.
+ * Parameters:
+ *   The list.
+ * Returns:
+ *   The thread woken, or NULL if there was none.
+ */
+thread wake_one(lwp_waitlist *w) {
+    thread t = wait_pop(w);
+    if (t != NULL) {
+        thread_unpark(t);
+    }
+    return t;
+}
+
+/*
+ * Description:
+ *   Initializes a mutex (the same as LWP_MUTEX_INITIALIZER).
+ * Parameters:
+ *   The mutex.
+ * Returns:
+ *   Nothing.
+ */
+void lwp_mutex_init(lwp_mutex *m) {
+    m->owner = NULL;
+    m->waiters.head = NULL;
+    m->waiters.tail = NULL;
+}
+
+/*
+ * Description:
+ *   Locks a mutex, waiting off the run queue while someone else holds
+ *   it. Ownership is handed over by lwp_mutex_unlock(), so when this
+ *   returns the caller already holds it.
+ * Parameters:
+ *   The mutex.
+ * Returns:
+ *   0 on success, -1 if the caller already holds it or it could
+ *   never be released.
+ */
+int lwp_mutex_lock(lwp_mutex *m) {
+    int was = preempt_enter();
+    int ret = 0;
+    if (m->owner == NULL) {
+        m->owner = running;
+    } else if (m->owner == running) {
+        ret = -1;
+    } else {
+        ret = wait_on(&m->waiters);
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Locks a mutex like lwp_mutex_lock(), giving up at a deadline.
+ * Parameters:
+ *   The mutex and a CLOCK_MONOTONIC deadline in ns.
+ * Returns:
+ *   0 on success, LWP_TIMEDOUT, or -1 if the caller already holds it.
+ */
+int lwp_mutex_timedlock(lwp_mutex *m, unsigned long abs_ns) {
+    int was = preempt_enter();
+    int ret = 0;
+    if (m->owner == NULL) {
+        m->owner = running;
+    } else if (m->owner == running) {
+        ret = -1;
+    } else {
+        ret = wait_until(&m->waiters, abs_ns ? abs_ns : 1);
+    }
+    /* 0 means no deadline to wait_until(); 1 is long past */
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Locks a mutex if nobody holds it.
+ * Parameters:
+ *   The mutex.
+ * Returns:
+ *   0 if it was locked, -1 if it is held.
+ */
+int lwp_mutex_trylock(lwp_mutex *m) {
+    int was = preempt_enter();
+    int ret = -1;
+    if (m->owner == NULL) {
+        m->owner = running;
+        ret = 0;
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Hands a mutex to its first waiter, or frees it if there is none.
+ * Parameters:
+ *   The mutex.
+ * Returns:
+ *   Nothing.
+ */
+static void release(lwp_mutex *m) {
+    m->owner = wake_one(&m->waiters);
+}
+
+/*
+ * Description:
+ *   Unlocks a mutex, handing it to the longest waiter if any.
+ * Parameters:
+ *   The mutex.
+ * Returns:
+ *   0 on success, -1 if the caller does not hold it.
+ */
+int lwp_mutex_unlock(lwp_mutex *m) {
+    int was = preempt_enter();
+    int ret = -1;
+    if (m->owner == running) {
+        release(m);
+        ret = 0;
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Initializes a condition variable (the same as
+ *   LWP_COND_INITIALIZER).
+ * Parameters:
+ *   The condition variable.
+ * Returns:
+ *   Nothing.
+ */
+void lwp_cond_init(lwp_cond *c) {
+    c->mutex = NULL;
+    c->waiters.head = NULL;
+    c->waiters.tail = NULL;
+}
+
+/*
+ * Description:
+ *   Unlocks a mutex and waits on a condition variable; see
+ *   lwp_cond_timedwait(). Must be called inside preempt_enter().
+ * Parameters:
+ *   The condition variable, the mutex and the deadline, or 0.
+ * Returns:
+ *   As lwp_cond_timedwait().
+ */
+static int cond_wait_until(lwp_cond *c, lwp_mutex *m, unsigned long abs_ns) {
+    thread self = running;
+    if (m->owner != self) {
+        return -1;
+    }
+    release(m);
+    c->mutex = m;
+    int ret = wait_until(&c->waiters, abs_ns);
+    if (ret == -1) {
+        m->owner = self;
+        /* nobody else could run, so nobody took the mutex */
+    } else if (ret == LWP_TIMEDOUT) {
+        if (m->owner == NULL) {
+            m->owner = self;
+        } else if (wait_on(&m->waiters) == -1) {
+            return -1;
+        }
+        /* take the mutex back, in line like anyone else */
+    }
+    /* a signal either gave us the mutex or queued us for it */
+    return ret;
+}
+
+/*
+ * Description:
+ *   Atomically unlocks a mutex and waits on a condition variable. Holds
+ *   the mutex again when it returns.
+ * Parameters:
+ *   The condition variable and the mutex, which the caller must hold.
+ *   Everyone waiting on it at once must use the same mutex.
+ * Returns:
+ *   0 once signalled, -1 if the caller does not hold the mutex or
+ *   could never be signalled.
+ */
+int lwp_cond_wait(lwp_cond *c, lwp_mutex *m) {
+    int was = preempt_enter();
+    int ret = cond_wait_until(c, m, 0);
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Waits on a condition variable like lwp_cond_wait(), giving up at a
+ *   deadline. Holds the mutex again when it returns either way.
+ * Parameters:
+ *   The condition variable, the mutex and a CLOCK_MONOTONIC deadline
+ *   in ns.
+ * Returns:
+ *   0 once signalled, LWP_TIMEDOUT, or -1 if the caller does not hold
+ *   the mutex.
+ */
+int lwp_cond_timedwait(lwp_cond *c, lwp_mutex *m, unsigned long abs_ns) {
+    int was = preempt_enter();
+    int ret = cond_wait_until(c, m, abs_ns ? abs_ns : 1);
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Moves a condition variable's first waiter over to its mutex: it
+ *   gets the mutex and runs if the mutex is free, and otherwise waits
+ *   for it without being woken first (wait morphing).
+ * Parameters:
+ *   The condition variable.
+ * Returns:
+ *   Nothing.
+ */
+static void morph(lwp_cond *c) {
+    thread t = wait_pop(&c->waiters);
+    if (t == NULL) {
+        return;
+    }
+    lwp_timer_cancel(&t->timer);
+    /* signalled: a timed wait now waits for the mutex however long */
+    if (c->mutex->owner == NULL) {
+        c->mutex->owner = t;
+        thread_unpark(t);
+    } else {
+        wait_append(&c->mutex->waiters, t);
+    }
+}
+
+/*
+ * Description:
+ *   Wakes the longest waiter on a condition variable, if any.
+ * Parameters:
+ *   The condition variable.
+ * Returns:
+ *   Nothing.
+ */
+void lwp_cond_signal(lwp_cond *c) {
+    int was = preempt_enter();
+    morph(c);
+    preempt_leave(was);
+}
+
+/*
+ * Description:
+ *   Wakes every waiter on a condition variable. At most one of them
+ *   runs; the rest are queued on the mutex in their waiting order.
+ * Parameters:
+ *   The condition variable.
+ * Returns:
+ *   Nothing.
+ */
+void lwp_cond_broadcast(lwp_cond *c) {
+    int was = preempt_enter();
+    while (c->waiters.head != NULL) {
+        morph(c);
+    }
+    /* one at a time, since each may have a timer to cancel */
+    preempt_leave(was);
+}
+
+/*
+ * Description:
+ *   Initializes a counting semaphore.
+ * Parameters:
+ *   The semaphore and its starting count.
+ * Returns:
+ *   Nothing.
+ */
+void lwp_sem_init(lwp_sem *s, unsigned long count) {
+    s->count = count;
+    s->waiters.head = NULL;
+    s->waiters.tail = NULL;
+}
+
+/*
+ * Description:
+ *   Takes one from a semaphore, waiting off the run queue while it is
+ *   zero.
+ * Parameters:
+ *   The semaphore.
+ * Returns:
+ *   0 on success, -1 if it could never be posted.
+ */
+int lwp_sem_wait(lwp_sem *s) {
+    int was = preempt_enter();
+    int ret = 0;
+    if (s->count > 0) {
+        s->count--;
+    } else {
+        ret = wait_on(&s->waiters);
+        /* lwp_sem_post() gave its unit straight to us */
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Takes one from a semaphore like lwp_sem_wait(), giving up at a
+ *   deadline.
+ * Parameters:
+ *   The semaphore and a CLOCK_MONOTONIC deadline in ns.
+ * Returns:
+ *   0 on success or LWP_TIMEDOUT.
+ */
+int lwp_sem_timedwait(lwp_sem *s, unsigned long abs_ns) {
+    int was = preempt_enter();
+    int ret = 0;
+    if (s->count > 0) {
+        s->count--;
+    } else {
+        ret = wait_until(&s->waiters, abs_ns ? abs_ns : 1);
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Takes one from a semaphore if it is above zero.
+ * Parameters:
+ *   The semaphore.
+ * Returns:
+ *   0 if it was taken, -1 if the count is zero.
+ */
+int lwp_sem_trywait(lwp_sem *s) {
+    int was = preempt_enter();
+    int ret = -1;
+    if (s->count > 0) {
+        s->count--;
+        ret = 0;
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Adds one to a semaphore, or hands it straight to the longest
+ *   waiter.
+ * Parameters:
+ *   The semaphore.
+ * Returns:
+ *   Nothing.
+ */
+void lwp_sem_post(lwp_sem *s) {
+    int was = preempt_enter();
+    if (wake_one(&s->waiters) == NULL) {
+        s->count++;
+    }
+    preempt_leave(was);
+}
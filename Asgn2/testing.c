@@ -2,8 +2,21 @@
 // Created by Ian on 4/24/2025.
 //
 
+#define shutdown sock_shutdown  // lwp.h has a shutdown() of its own
+#include <sys/socket.h>
+#undef shutdown
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "lwp.h"
+#include "schedulers.h"
+
+static volatile int stop = FALSE;
+static long turns[3];
 
 int test1(void *arg) {
     printf("%d: hello!\n", *(int *)arg);
@@ -12,6 +25,461 @@ int test1(void *arg) {
     return 0;
 }
 
+int spin(void *arg) {
+    long *count = arg;
+    while (!stop) {
+        (*count)++;
+        lwp_yield();
+    }
+    return 0;
+}
+
+// Threads carrying EDF deadlines must still get turns after a switch
+// to Fair (their deadline used to be taken as their vruntime).
+int test_edf_to_fair(void) {
+    tid_t tids[3];
+    int i, bad = 0;
+    unsigned long now = lwp_now_ns();
+
+    lwp_set_scheduler(EarliestDeadline);
+    lwp_set_deadline(lwp_gettid(), now);    // else the spinners starve us
+    stop = FALSE;
+    for (i = 0; i < 3; i++) {
+        turns[i] = 0;
+        tids[i] = lwp_create(spin, turns + i);
+        lwp_set_deadline(tids[i], now + (i + 1) * 1000000000UL);
+    }
+    for (i = 0; i < 10; i++) {
+        lwp_yield();
+    }
+    lwp_set_scheduler(Fair);
+    lwp_set_deadline(lwp_gettid(), 0);
+    for (i = 0; i < 3; i++) {
+        turns[i] = 0;
+    }
+    for (i = 0; i < 3000; i++) {
+        lwp_yield();
+    }
+    stop = TRUE;
+    for (i = 0; i < 3; i++) {
+        lwp_join(tids[i], NULL);
+        if (turns[i] == 0) {
+            bad = 1;
+        }
+    }
+    printf("edf->fair turns: %ld %ld %ld\n", turns[0], turns[1], turns[2]);
+    lwp_set_scheduler(NULL);
+    return bad;
+}
+
+int quit(void *arg) {
+    (void)arg;
+    lwp_exit(7);
+    return 0;
+}
+
+int taker(void *arg) {
+    tid_t *victim = arg;
+    if (victim[1]) {
+        lwp_detach(victim[0]);
+    } else {
+        lwp_join(victim[0], NULL);
+    }
+    lwp_yield();    // let the waiter run while the zombie list is empty
+    lwp_exit(8);
+    return 0;
+}
+
+// lwp_wait must cope with the zombie that woke it being taken by
+// lwp_join or lwp_detach before it runs again (it used to dequeue the
+// list's sentinel). Under round robin: we block in lwp_wait, X exits
+// and wakes us, then the taker claims X; the wait should end up
+// reaping the taker instead.
+int test_wait_race(void) {
+    int mode, bad = 0;
+    lwp_set_scheduler(NULL);
+    for (mode = 0; mode < 2; mode++) {
+        tid_t victim[2];
+        int status = 0;
+        victim[0] = lwp_create(quit, NULL);
+        victim[1] = mode;
+        tid_t taken = lwp_create(taker, victim);
+        tid_t got = lwp_wait(&status);
+        if (got != taken || LWPTERMSTAT(status) != 8) {
+            bad = 1;
+        }
+        printf("wait vs %s: reaped %s\n", mode ? "detach" : "join",
+               got == taken ? "the taker" : "something else");
+    }
+    return bad;
+}
+
+#define NTIMERS 100000
+
+static long fired = 0, misfired = 0;
+
+void count_fire(lwp_timer *t) {
+    if (t->arg != NULL) {
+        misfired++;    // it was cancelled
+    }
+    fired++;
+}
+
+// Arms 100k timers over the next 20ms, cancels every other one, and
+// sleeps past them all: exactly the rest must fire.
+int test_timer_churn(void) {
+    lwp_timer *timers = calloc(NTIMERS, sizeof(lwp_timer));
+    long i, cancelled = 0;
+    int bad;
+    if (timers == NULL) {
+        return 1;
+    }
+    fired = misfired = 0;
+    unsigned long start = lwp_now_ns();
+    for (i = 0; i < NTIMERS; i++) {
+        lwp_timer_arm(timers + i, start + (i * 7919) % 20000000,
+                      count_fire, NULL);
+    }
+    for (i = 0; i < NTIMERS; i += 2) {
+        if (lwp_timer_cancel(timers + i)) {
+            timers[i].arg = timers;
+            cancelled++;
+        }
+    }
+    unsigned long setup = lwp_now_ns() - start;
+    lwp_sleep_until(start + 21000000);
+    bad = misfired != 0 || fired + cancelled != NTIMERS
+          || lwp_timer_cancel(timers + 1);
+    printf("timers: %ld fired, %ld cancelled, %.1f ns per arm/cancel\n",
+           fired, cancelled, (double)setup / (NTIMERS + NTIMERS / 2));
+    free(timers);
+    return bad;
+}
+
+static unsigned char xpat[32], xseen[32], xback[32];
+
+// ymm15 if the CPU has AVX, else just xmm15 (the first 16 bytes)
+void vec_set(unsigned char *from) {
+    if (lwp_xmask & 0x4) {
+        __asm__ volatile ("vmovdqu (%0), %%ymm15" : : "r"(from) : "xmm15");
+    } else {
+        __asm__ volatile ("movdqu (%0), %%xmm15" : : "r"(from) : "xmm15");
+    }
+}
+
+void vec_get(unsigned char *to) {
+    if (lwp_xmask & 0x4) {
+        __asm__ volatile ("vmovdqu %%ymm15, (%0)" : : "r"(to) : "memory");
+    } else {
+        __asm__ volatile ("movdqu %%xmm15, (%0)" : : "r"(to) : "memory");
+    }
+}
+
+int xwriter(void *arg) {
+    (void)arg;
+    vec_set(xpat);
+    lwp_yield();
+    vec_get(xback);
+    return 0;
+}
+
+int xreader(void *arg) {
+    (void)arg;
+    vec_get(xseen);
+    return 0;
+}
+
+// An LWP_XSTATE thread's vector registers are its own: the thread
+// that runs after it must not see them, and it must get them back.
+int test_xstate(void) {
+    lwp_attr attr = { 0, NULL, 0, LWP_XSTATE };
+    int i, bad;
+    for (i = 0; i < 32; i++) {
+        xpat[i] = 0xa0 + i;
+    }
+    memset(xseen, 0, sizeof(xseen));
+    memset(xback, 0, sizeof(xback));
+    lwp_set_scheduler(NULL);
+    tid_t w = lwp_create_ex(xwriter, NULL, &attr);
+    tid_t r = lwp_create(xreader, NULL);
+    if (w == NO_THREAD || r == NO_THREAD) {
+        return 1;
+    }
+    size_t n = (lwp_xmask & 0x4) ? 32 : 16;    // known once w exists
+    lwp_join(w, NULL);
+    lwp_join(r, NULL);
+    bad = memcmp(xseen, xpat, n) == 0 || memcmp(xback, xpat, n) != 0;
+    printf("xstate (%zu bytes, mode %d): %s\n", n, lwp_xmode,
+           bad ? "leaked or lost" : "private");
+    return bad;
+}
+
+static lwp_mutex tm = LWP_MUTEX_INITIALIZER;
+static lwp_cond tc = LWP_COND_INITIALIZER;
+static int order[3], norder, arrived, go;
+
+int locker(void *arg) {
+    arrived++;
+    lwp_mutex_lock(&tm);
+    order[norder++] = (int)(long)arg;
+    lwp_mutex_unlock(&tm);
+    return 0;
+}
+
+int cond_waiter(void *arg) {
+    (void)arg;
+    lwp_mutex_lock(&tm);
+    arrived++;
+    while (!go) {
+        lwp_cond_wait(&tc, &tm);
+    }
+    norder++;
+    lwp_mutex_unlock(&tm);
+    return 0;
+}
+
+// Unlocking hands the mutex to its longest waiter, so the waiters get
+// it in the order they blocked and the unlocker cannot barge back in.
+// A broadcast wakes every cond waiter, and a sem timed wait with
+// nothing posted times out.
+int test_sync(void) {
+    tid_t t[3];
+    lwp_sem sem;
+    int i, bad = 0;
+
+    lwp_set_scheduler(NULL);
+    norder = arrived = 0;
+    lwp_mutex_lock(&tm);
+    for (i = 0; i < 3; i++) {
+        t[i] = lwp_create(locker, (void *)(long)i);
+    }
+    while (arrived < 3) {
+        lwp_yield();    // each of them blocks on tm, in turn
+    }
+    lwp_mutex_unlock(&tm);
+    if (lwp_mutex_trylock(&tm) == 0) {
+        bad = 1;
+        lwp_mutex_unlock(&tm);
+    }
+    for (i = 0; i < 3; i++) {
+        lwp_join(t[i], NULL);
+    }
+    if (norder != 3 || order[0] != 0 || order[1] != 1 || order[2] != 2) {
+        bad = 1;
+    }
+
+    norder = arrived = go = 0;
+    for (i = 0; i < 3; i++) {
+        t[i] = lwp_create(cond_waiter, NULL);
+    }
+    while (arrived < 3) {
+        lwp_yield();
+    }
+    lwp_mutex_lock(&tm);
+    go = 1;
+    lwp_cond_broadcast(&tc);
+    lwp_mutex_unlock(&tm);
+    for (i = 0; i < 3; i++) {
+        lwp_join(t[i], NULL);
+    }
+    if (norder != 3) {
+        bad = 1;
+    }
+
+    lwp_sem_init(&sem, 0);
+    if (lwp_sem_timedwait(&sem, lwp_now_ns() + 2000000) != LWP_TIMEDOUT) {
+        bad = 1;
+    }
+    lwp_sem_post(&sem);
+    if (lwp_sem_trywait(&sem) != 0 || lwp_sem_trywait(&sem) == 0) {
+        bad = 1;
+    }
+    printf("sync: lock order %d %d %d, %d woken by broadcast: %s\n",
+           order[0], order[1], order[2], norder, bad ? "FAILED" : "ok");
+    return bad;
+}
+
+static lwp_chan *tch;
+static long tgot;
+static int tresult;
+
+int chan_receiver(void *arg) {
+    (void)arg;
+    arrived++;
+    tresult = lwp_chan_recv(tch, &tgot);
+    return 0;
+}
+
+typedef struct blob {
+    long v[8];
+} blob;
+
+// both run on the one shared stack, so the element has to go through
+// the channel's bounce buffers
+int shared_recv(void *arg) {
+    blob b;
+    int i;
+    if (lwp_chan_recv((lwp_chan *)arg, &b) != 0) {
+        return 1;
+    }
+    for (i = 0; i < 8; i++) {
+        if (b.v[i] != i * 11) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int shared_send(void *arg) {
+    blob b;
+    int i;
+    for (i = 0; i < 8; i++) {
+        b.v[i] = i * 11;
+    }
+    return lwp_chan_send((lwp_chan *)arg, &b) != 0;
+}
+
+// An unbuffered send goes straight into a waiting receiver; select
+// takes turns between ready channels; close wakes waiters with
+// LWP_CHAN_CLOSED but leaves buffered elements to be received; and
+// threads on a shared stack can pass elements to each other.
+int test_chan(void) {
+    lwp_attr shared = { 0, NULL, 0, LWP_SHARED };
+    lwp_chan *a = LWP_CHAN(long, 16), *b = LWP_CHAN(long, 16);
+    lwp_chancase cases[2];
+    long v = 42, picked[2] = { 0, 0 };
+    int i, st1 = -1, st2 = -1, bad = 0;
+
+    lwp_set_scheduler(NULL);
+    tch = LWP_CHAN(long, 0);
+    arrived = 0;
+    tgot = 0;
+    tid_t r = lwp_create(chan_receiver, NULL);
+    while (arrived < 1) {
+        lwp_yield();
+    }
+    if (lwp_chan_send(tch, &v) != 0 || tgot != 42 || tresult != 0
+        || tch->len != 0) {
+        bad = 1;
+    }
+    lwp_join(r, NULL);
+
+    for (i = 0; i < 10; i++) {
+        lwp_chan_send(a, &v);
+        lwp_chan_send(b, &v);
+    }
+    cases[0] = (lwp_chancase){ a, FALSE, &v, 0 };
+    cases[1] = (lwp_chancase){ b, FALSE, &v, 0 };
+    for (i = 0; i < 10; i++) {
+        int k = lwp_chan_select(cases, 2, FALSE);
+        if (k >= 0) {
+            picked[k]++;
+        }
+    }
+    if (picked[0] < 4 || picked[1] < 4 || picked[0] + picked[1] != 10) {
+        bad = 1;
+    }
+
+    arrived = 0;
+    r = lwp_create(chan_receiver, NULL);
+    while (arrived < 1) {
+        lwp_yield();
+    }
+    lwp_chan_close(tch);
+    lwp_join(r, NULL);
+    if (tresult != LWP_CHAN_CLOSED) {
+        bad = 1;
+    }
+    lwp_chan_close(a);
+    if (lwp_chan_recv(a, &v) != 0 || lwp_chan_send(a, &v) != LWP_CHAN_CLOSED
+        || lwp_chan_close(a) != -1) {
+        bad = 1;
+    }
+
+    lwp_chan *sc = LWP_CHAN(blob, 0);
+    lwp_shared_stacks(1, 65536);
+    tid_t rs = lwp_create_ex(shared_recv, sc, &shared);
+    tid_t ss = lwp_create_ex(shared_send, sc, &shared);
+    lwp_join(rs, &st1);
+    lwp_join(ss, &st2);
+    if (rs == NO_THREAD || ss == NO_THREAD
+        || LWPTERMSTAT(st1) != 0 || LWPTERMSTAT(st2) != 0) {
+        bad = 1;
+    }
+
+    printf("chan: select picked %ld/%ld, shared stack %s: %s\n",
+           picked[0], picked[1], (LWPTERMSTAT(st1) | LWPTERMSTAT(st2))
+           ? "garbled" : "intact", bad ? "FAILED" : "ok");
+    lwp_chan_free(tch);
+    lwp_chan_free(a);
+    lwp_chan_free(b);
+    lwp_chan_free(sc);
+    return bad;
+}
+
+static char ioback[8];
+
+int io_reader(void *arg) {
+    arrived++;
+    return lwp_read((int)(long)arg, ioback, sizeof(ioback)) != 4;
+}
+
+// A connect to a port nobody listens on fails with ECONNREFUSED
+// rather than reporting success; a read with nothing to read parks
+// only its own thread until the data comes; and a poll with nothing
+// to report returns 0 at its deadline.
+int test_io(void) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int sv[2], st = -1, bad = 0, err = 0;
+
+    lwp_set_scheduler(NULL);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1
+        || getsockname(fd, (struct sockaddr *)&addr, &len) == -1) {
+        return 1;
+    }
+    close(fd);
+    // a free port, bound once and never listened on
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lwp_connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != -1) {
+        bad = 1;
+    } else {
+        err = errno;
+        bad = err != ECONNREFUSED;
+    }
+    lwp_close(fd);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+        return 1;
+    }
+    arrived = 0;
+    memset(ioback, 0, sizeof(ioback));
+    tid_t r = lwp_create(io_reader, (void *)(long)sv[1]);
+    while (arrived < 1) {
+        lwp_yield();
+    }
+    lwp_yield();    // it is parked on the read, and we still run
+    if (ioback[0] != 0 || lwp_write(sv[0], "ping", 4) != 4) {
+        bad = 1;
+    }
+    lwp_join(r, &st);
+    if (LWPTERMSTAT(st) != 0 || memcmp(ioback, "ping", 4) != 0) {
+        bad = 1;
+    }
+    if (lwp_poll_fd(sv[1], POLLIN, lwp_now_ns() + 2000000) != 0) {
+        bad = 1;
+    }
+    lwp_close(sv[0]);
+    lwp_close(sv[1]);
+    printf("io: refused connect gave %s, read got \"%.4s\": %s\n",
+           strerror(err), ioback, bad ? "FAILED" : "ok");
+    return bad;
+}
+
 int main(void) {
     int i, num[10] = {0, 1, 2, 3, 4,5,6,7,8,9};
     for (i = 0; i < 10; i++) {
@@ -24,5 +492,16 @@ int main(void) {
         lwp_wait(&status);
         printf("%d: %d\n", i, status);
     }
-    return 0;
+    int failed = 0;
+    failed += test_edf_to_fair();
+    failed += test_wait_race();
+    failed += test_timer_churn();
+    failed += test_xstate();
+    failed += test_sync();
+    failed += test_chan();
+    failed += test_io();
+    if (failed) {
+        printf("%d test(s) FAILED\n", failed);
+    }
+    return failed;
 }
\ No newline at end of file
@@ -0,0 +1,357 @@
+/*
+ * Description: This file contains the library's timers: a hierarchical
+ *              timing wheel of LWP_TIMER_LEVELS levels of 64 slots. Time
+ *              is counted in ticks of 2^TICK_SHIFT ns; level L holds the
+ *              timers due within 64^(L+1) ticks, by bits 6L..6L+5 of
+ *              their expiry tick, and a slot is pushed down a level
+ *              (cascaded) when the clock reaches it. Arming and
+ *              cancelling are O(1), and a bitmap per level lets the
+ *              clock jump straight to the next slot with anything in it.
+ *              Timers are run from lwp_yield(), and when no thread is
+ *              runnable the process sleeps until the next one is due.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TICK_SHIFT 16                       /* 65.5us ticks */
+#define TICK_NS    (1UL << TICK_SHIFT)
+#define SLOT_BITS  6
+#define SLOTS      (1 << SLOT_BITS)
+
+static lwp_timer *wheel[LWP_TIMER_LEVELS][SLOTS];
+static unsigned long occupied[LWP_TIMER_LEVELS];   /* bit per slot */
+static unsigned long cur = 0;       /* next tick to process */
+static unsigned long due = ~0UL;    /* ns; nothing is due before this */
+static long armed = 0;
+
+/*
+ * Description:
+ *   Puts an armed timer in the slot for its expiry: the lowest level
+ *   whose span covers it, in the slot of that level's digit of the
+ *   expiry tick. Ones too far out for the top level wait in its last
+ *   slot and are placed again when it cascades.
+ * Parameters:
+ *   The timer.
+ * Returns:
+ *   Nothing.
+ */
+static void place(lwp_timer *t) {
+    unsigned long tick = (t->expires + TICK_NS - 1) >> TICK_SHIFT;
+    int level = 0;
+    if (tick < cur) {
+        tick = cur;
+    }
+    /* rounded up so it never fires early */
+    unsigned long delta = tick - cur;
+    while (level < LWP_TIMER_LEVELS - 1
+           && (delta >> (SLOT_BITS * (level + 1))) != 0) {
+        level++;
+    }
+    if ((delta >> (SLOT_BITS * LWP_TIMER_LEVELS)) != 0) {
+        tick = cur + (1UL << (SLOT_BITS * LWP_TIMER_LEVELS)) - 1;
+    }
+
+    int idx = (tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+    lwp_timer **head = &wheel[level][idx];
+    if (*head == NULL) {
+        t->next = t->prev = t;
+        *head = t;
+    } else {
+        t->next = *head;
+        t->prev = (*head)->prev;
+        (*head)->prev->next = t;
+        (*head)->prev = t;
+    }
+    t->slot = level * SLOTS + idx;
+    occupied[level] |= 1UL << idx;
+}
+
+/*
+ * Description:
+ *   Takes a timer out of its slot.
+ * Parameters:
+ *   The timer (which must be in one).
+ * Returns:
+ *   Nothing.
+ */
+static void unplace(lwp_timer *t) {
+    int level = t->slot / SLOTS, idx = t->slot % SLOTS;
+    lwp_timer **head = &wheel[level][idx];
+    if (t->next == t) {
+        *head = NULL;
+        occupied[level] &= ~(1UL << idx);
+    } else {
+        t->prev->next = t->next;
+        t->next->prev = t->prev;
+        if (*head == t) {
+            *head = t->next;
+        }
+    }
+    t->next = t->prev = NULL;
+}
+
+/*
+ * Description:
+ *   Finds the next tick at which something has to happen: a level-0
+ *   slot with timers, or a higher slot with timers to cascade.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   That tick, or ~0 if no timer is armed.
+ */
+static unsigned long next_tick(void) {
+    unsigned long best = ~0UL;
+    int level;
+    for (level = 0; level < LWP_TIMER_LEVELS; level++) {
+        unsigned long bits = occupied[level];
+        if (bits == 0) {
+            continue;
+        }
+        int shift = SLOT_BITS * level;
+        unsigned long block = (cur + (1UL << shift) - 1) >> shift;
+        int digit = block & (SLOTS - 1);
+        if (digit != 0) {
+            bits = (bits >> digit) | (bits << (SLOTS - digit));
+        }
+        /* rotated so bit 0 is the first slot still to come */
+        unsigned long tick = (block + __builtin_ctzl(bits)) << shift;
+        if (tick < best) {
+            best = tick;
+        }
+    }
+    return best;
+}
+
+/*
+ * Description:
+ *   Runs the clock up to a tick, cascading and firing on the way.
+ * Parameters:
+ *   The last tick to process.
+ * Returns:
+ *   Nothing.
+ */
+static void advance(unsigned long target) {
+    for (;;) {
+        unsigned long tick = next_tick();
+        if (tick > target) {
+            break;
+        }
+        cur = tick;
+
+        int level;
+        for (level = LWP_TIMER_LEVELS - 1; level > 0; level--) {
+            int shift = SLOT_BITS * level;
+            if ((cur & ((1UL << shift) - 1)) != 0) {
+                continue;
+            }
+            int idx = (cur >> shift) & (SLOTS - 1);
+            lwp_timer *t;
+            while ((t = wheel[level][idx]) != NULL) {
+                unplace(t);
+                place(t);
+            }
+        }
+        /* push due slots down, from the top so they can fall through */
+
+        lwp_timer **head = &wheel[0][cur & (SLOTS - 1)];
+        while (*head != NULL) {
+            lwp_timer *t = *head;
+            unplace(t);
+            armed--;
+            t->fire(t);
+        }
+        cur++;
+    }
+    if (cur <= target) {
+        cur = target + 1;
+    }
+    /* nothing was due in between, so everything stays where it is */
+    due = (armed > 0) ? next_tick() << TICK_SHIFT : ~0UL;
+}
+
+/*
+ * Description:
+ *   Arms a timer to call fire(timer) at an absolute time, from inside
+ *   the library on whichever thread is switching. fire must not block.
+ *   Re-arming an armed timer moves it.
+ * Parameters:
+ *   The timer, the CLOCK_MONOTONIC time in ns, the function and an
+ *   argument for it (left in timer->arg).
+ * Returns:
+ *   Nothing.
+ */
+void lwp_timer_arm(lwp_timer *t, unsigned long abs_ns,
+                   void (*fire)(lwp_timer *), void *arg) {
+    int was = preempt_enter();
+    if (t->next != NULL) {
+        unplace(t);
+        armed--;
+    }
+    if (armed == 0) {
+        cur = lwp_now_ns() >> TICK_SHIFT;
+    }
+    /* an empty wheel can start from now */
+    t->expires = abs_ns;
+    t->fire = fire;
+    t->arg = arg;
+    place(t);
+    armed++;
+    if (abs_ns < due) {
+        due = abs_ns;
+    }
+    /* a lower bound is enough: the wheel catches up when it is hit */
+    preempt_leave(was);
+}
+
+/*
+ * Description:
+ *   Disarms a timer. Does nothing if it is not armed.
+ * Parameters:
+ *   The timer.
+ * Returns:
+ *   TRUE if it was armed, FALSE if it had fired or never been armed.
+ */
+int lwp_timer_cancel(lwp_timer *t) {
+    int was = preempt_enter();
+    int ret = FALSE;
+    if (t->next != NULL) {
+        unplace(t);
+        armed--;
+        ret = TRUE;
+    }
+    preempt_leave(was);
+    return ret;
+}
+
+/*
+ * Description:
+ *   Initializes a timer as disarmed. Timers in zeroed memory need not
+ *   be.
+ * Parameters:
+ *   The timer.
+ * Returns:
+ *   Nothing.
+ */
+void lwp_timer_init(lwp_timer *t) {
+    t->next = t->prev = NULL;
+}
+
+/*
+ * Description:
+ *   Fires every timer that is due. Cheap when none are.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   Nothing.
+ */
+void timer_poll(void) {
+    if (armed > 0) {
+        unsigned long now = lwp_now_ns();
+        if (now >= due) {
+            advance(now >> TICK_SHIFT);
+        }
+    }
+}
+
+/*
+ * Description:
+ *   Tells how many timers are armed.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The count.
+ */
+long timer_armed(void) {
+    return armed;
+}
+
+/*
+ * Description:
+ *   Tells how long until the next timer may be due, for callers that
+ *   sleep some other way than timer_idle().
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The time in ns (0 if one is due now), or -1 if no timer is armed.
+ */
+long timer_wait_ns(void) {
+    if (armed == 0) {
+        return -1;
+    }
+    unsigned long now = lwp_now_ns();
+    return (due > now) ? (long)(due - now) : 0;
+}
+
+/*
+ * Description:
+ *   Sleeps the whole process until the next timer is due and fires
+ *   it. For when no thread is runnable.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   0, or -1 if no timer is armed (nothing would ever wake).
+ */
+int timer_idle(void) {
+    if (armed == 0) {
+        return -1;
+    }
+    struct timespec ts;
+    ts.tv_sec = due / 1000000000UL;
+    ts.tv_nsec = due % 1000000000UL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+           == EINTR) {
+        /* a preemption tick; nobody to preempt */
+    }
+    timer_poll();
+    return 0;
+}
+
+/*
+ * Description:
+ *   Wakes a thread put to sleep by lwp_sleep_until().
+ * Parameters:
+ *   Its timer.
+ * Returns:
+ *   Nothing.
+ */
+static void sleep_done(lwp_timer *t) {
+    thread_unpark((thread)t->arg);
+}
+
+/*
+ * Description:
+ *   Takes the calling thread off the run queue until a given time.
+ * Parameters:
+ *   The CLOCK_MONOTONIC time in ns.
+ * Returns:
+ *   0 (at once if the time has passed).
+ */
+int lwp_sleep_until(unsigned long abs_ns) {
+    int was = preempt_enter();
+    if (abs_ns > lwp_now_ns()) {
+        thread self = running;
+        thread_park(self);
+        lwp_timer_arm(&self->timer, abs_ns, sleep_done, self);
+        lwp_yield();
+    }
+    preempt_leave(was);
+    return 0;
+}
+
+/*
+ * Description:
+ *   Takes the calling thread off the run queue for a while.
+ * Parameters:
+ *   How long, in ns.
+ * Returns:
+ *   0.
+ */
+int lwp_sleep_ns(unsigned long ns) {
+    return lwp_sleep_until(lwp_now_ns() + ns);
+}
@@ -0,0 +1,178 @@
+/*
+ * Description: This file sizes and allocates XSAVE areas for LWP_XSTATE
+ *              threads, whose extended register state (x87, SSE, AVX,
+ *              AVX-512) is private: lwp_switch saves it with XSAVEOPT or
+ *              XSAVEC when they switch out, restores it with XRSTOR when
+ *              they switch back, and does not leave it in the registers
+ *              for whoever runs next.
+ * Author: iwong12
+ * Date: 2026-10-17
+ */
+
+#include "lwp.h"
+#include <cpuid.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define XSAVE_ALIGN 64
+#define XSAVE_LEGACY 512                  /* fxsave image at the front */
+#define XSAVE_HEADER 64                   /* then the XSAVE header     */
+#define XSAVE_BIT (1 << 26)
+#define OSXSAVE_BIT (1 << 27)
+#define XSAVEOPT_BIT (1 << 0)
+#define XSAVEC_BIT (1 << 1)
+
+/* x87, SSE, AVX and the three AVX-512 components. PKRU is process
+   policy rather than thread state, and the AMX tiles need the kernel's
+   permission first, so neither is switched. */
+#define XFEATURES 0xe7UL
+
+unsigned long lwp_xmask = 0;
+unsigned long lwp_xsize = 0;
+int lwp_xmode = XMODE_NONE;
+static int probed = FALSE;
+static void *xinit = NULL;               /* an area in the initial state */
+
+/*
+ * Description:
+ *   Reads an extended control register.
+ * Parameters:
+ *   The index of the register (0 for XCR0).
+ * Returns:
+ *   Its value.
+ */
+static unsigned long xgetbv(unsigned int index) {
+    unsigned int eax, edx;
+    __asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return ((unsigned long)edx << 32) | eax;
+}
+
+/*
+ * Description:
+ *   Detects which of the components we switch the OS has enabled, how
+ *   big a standard-format area holding them is, and the best XSAVE
+ *   variant available. Without XSAVE, areas are plain fxsave images.
+ *   Only does the work once.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   lwp_xmode: XMODE_NONE if XSAVE cannot be used.
+ */
+int xstate_probe(void) {
+    unsigned int eax, ebx, ecx, edx, i;
+
+    if (probed == TRUE) {
+        return lwp_xmode;
+    }
+    probed = TRUE;
+    lwp_xsize = XSAVE_LEGACY;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
+        return lwp_xmode;
+    }
+    if ((ecx & XSAVE_BIT) == 0 || (ecx & OSXSAVE_BIT) == 0) {
+        return lwp_xmode;
+    }
+    /* the OS has to have turned XSAVE on for us to use it */
+
+    lwp_xmask = xgetbv(0) & XFEATURES;
+    lwp_xsize = XSAVE_LEGACY + XSAVE_HEADER;
+    for (i = 2; i < 64; i++) {
+        if (lwp_xmask & (1UL << i)) {
+            __cpuid_count(0xd, i, eax, ebx, ecx, edx);
+            if (ebx + eax > lwp_xsize) {
+                lwp_xsize = ebx + eax;
+            }
+        }
+    }
+    /* each component's size (eax) and standard-format offset (ebx);
+       the compacted format is never bigger */
+
+    __cpuid_count(0xd, 1, eax, ebx, ecx, edx);
+    if (eax & XSAVEOPT_BIT) {
+        lwp_xmode = XMODE_XSAVEOPT;
+    } else if (eax & XSAVEC_BIT) {
+        lwp_xmode = XMODE_XSAVEC;
+    } else {
+        lwp_xmode = XMODE_XSAVE;
+    }
+    return lwp_xmode;
+}
+
+/*
+ * Description:
+ *   Makes an area that restores as the initial state: the fxsave image
+ *   of a fresh FPU (xrstor still takes MXCSR from it) and an all-zero
+ *   header, which marks every other component as initial.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The area, or NULL on error.
+ */
+static void *xstate_fresh(void) {
+    size_t size = (lwp_xsize + XSAVE_ALIGN - 1) & ~(XSAVE_ALIGN - 1);
+    void *area = aligned_alloc(XSAVE_ALIGN, size);
+    if (area == NULL) {
+        perror("error allocating xsave area");
+        return NULL;
+    }
+    memset(area, 0, size);
+    *(struct fxsave *)area = FPU_INIT;
+    return area;
+}
+
+/*
+ * Description:
+ *   Gets a private state area for an LWP_XSTATE thread, and the first
+ *   time, the initial-state area lwp_switch scrubs the registers with.
+ * Parameters:
+ *   None.
+ * Returns:
+ *   The area, or NULL on error.
+ */
+void *xstate_alloc(void) {
+    xstate_probe();
+    if (xinit == NULL) {
+        xinit = xstate_fresh();
+        if (xinit == NULL) {
+            return NULL;
+        }
+    }
+    return xstate_fresh();
+}
+
+/*
+ * Description:
+ *   Releases a thread's state area.
+ * Parameters:
+ *   The area, or NULL.
+ * Returns:
+ *   Nothing.
+ */
+void xstate_free(void *area) {
+    free(area);
+}
+
+/*
+ * Description:
+ *   Switches the extended register state for lwp_switch. An
+ *   LWP_XSTATE thread switching out saves its state and, unless the
+ *   next thread has its own to load, leaves the initial state behind.
+ * Parameters:
+ *   The state areas of the thread switching out and the one to run,
+ *   either of which may be NULL.
+ * Returns:
+ *   Nothing.
+ */
+void xstate_switch(void *from, void *to) {
+    if (from != NULL) {
+        xstate_save(from, lwp_xmask);
+        if (to == NULL) {
+            xstate_load(xinit, lwp_xmask);
+        }
+    }
+    if (to != NULL) {
+        xstate_load(to, lwp_xmask);
+    }
+}